@@ -0,0 +1,594 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/gpio/driver.h>
+#include <linux/delay.h>
+#include <linux/irq.h>
+#include <linux/irq_work.h>
+
+#include "galeos.h"
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Dmitriy Vakhrushev");
+MODULE_DESCRIPTION("Simulated galeos shdsl modems on a virtual SPI controller.");
+MODULE_VERSION("0.1");
+
+/*
+ * Every simulated modem sits on its own chip select of a virtual SPI
+ * controller and owns four lines of a fake gpiochip. The SPI side follows
+ * the modem protocol: with gpio-ac low a byte is the register address
+ * (bit 7 set for a read), with gpio-ac high it is the data. A trace
+ * set with galeos_sim_trace() records the register accesses and counts
+ * the SPI messages for the KUnit suite (galeos_test.c).
+ *
+ * The irq and rdy lines have interrupts of their own, so the driver gets
+ * them through gpio_to_irq(). galeos_sim_drop_rdy() and
+ * galeos_sim_raise_rdy() make a modem busy and ready again, the rising
+ * edge raises the rdy interrupt. galeos_sim_raise_irq() flags channels in
+ * the interrupt register (0x62) and asserts the level interrupt until the
+ * register is read. Mode changes flag their channel without asserting
+ * the line.
+ */
+#define GALEOS_SIM_MAX_MODEMS 4
+
+#define GALEOS_SIM_LINE_AC    0
+#define GALEOS_SIM_LINE_RESET 1
+#define GALEOS_SIM_LINE_IRQ   2
+#define GALEOS_SIM_LINE_RDY   3
+#define GALEOS_SIM_LINES      4
+
+/* Interrupts of a modem: the irq line, then the rdy line */
+#define GALEOS_SIM_IRQS           2
+#define GALEOS_SIM_IRQ(modem)     ((modem) * GALEOS_SIM_IRQS)
+#define GALEOS_SIM_IRQ_RDY(modem) ((modem) * GALEOS_SIM_IRQS + 1)
+
+static unsigned int modems = 1;
+module_param( modems, uint, S_IRUGO );
+MODULE_PARM_DESC(modems, "Number of simulated modems (1-4)");
+static int bus_num = -1;
+module_param( bus_num, int, S_IRUGO );
+MODULE_PARM_DESC(bus_num, "SPI bus number of the virtual controller, -1 for dynamic");
+static unsigned int speed_hz = 0;
+module_param( speed_hz, uint, S_IRUGO );
+MODULE_PARM_DESC(speed_hz, "SPI clock passed to the driver as board data, 0 lets the driver calibrate");
+static unsigned int max_hz = 20000000;
+module_param( max_hz, uint, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC(max_hz, "Highest SPI clock the simulated board carries, faster reads return garbage");
+static unsigned int latency_us = 0;
+module_param( latency_us, uint, S_IRUGO | S_IWUSR );
+MODULE_PARM_DESC(latency_us, "Simulated latency of every SPI transfer in us");
+static unsigned int type = 0x42;
+module_param( type, uint, S_IRUGO );
+MODULE_PARM_DESC(type, "Modem type returned by register 0x60");
+static unsigned int version = 0x01;
+module_param( version, uint, S_IRUGO );
+MODULE_PARM_DESC(version, "Modem version returned by register 0x61");
+
+typedef struct {
+  u8  page;
+  u8  addr;
+  bool read;
+  u8  irq;
+  bool irq_line;    /* asserted until 0x62 is read */
+  unsigned rdy_drop; /* accesses until rdy goes low, 0 for none */
+  u8  scratch;
+  u8  regs[GALEOS_PAGES][GALEOS_PAGE_LEN];
+} galeos_sim_modem_t;
+
+typedef struct {
+  struct platform_device *pdev;
+  struct spi_master *master;
+  struct gpio_chip chip;
+  bool chip_added;
+  unsigned long lines;
+  /* Interrupts of the irq and rdy lines, see GALEOS_SIM_IRQ() */
+  int irq_base;
+  unsigned irqs;
+  unsigned long irq_masked;
+  unsigned long irq_pending;
+  struct irq_work irq_work;
+  galeos_sim_modem_t modem[GALEOS_SIM_MAX_MODEMS];
+  struct galeos_platform_data pdata[GALEOS_SIM_MAX_MODEMS];
+  struct spi_device *spi[GALEOS_SIM_MAX_MODEMS];
+  /* Bus accounting, /sys/kernel/debug/galeos-sim/stats */
+  struct dentry *debugfs;
+  u64 messages;
+  u64 transfers;
+  u64 bytes;
+  unsigned long cs_lines; /* asserted chip selects */
+  galeos_sim_trace_t *trace;
+} galeos_sim_t;
+
+static galeos_sim_t *galeos_sim;
+
+struct spi_device *galeos_sim_spi( unsigned modem )
+{
+  if(!galeos_sim || modem >= modems)
+    return NULL;
+  return galeos_sim->spi[modem];
+}
+EXPORT_SYMBOL_GPL(galeos_sim_spi);
+
+/* Start recording into trace, or stop with NULL; the bus should be idle */
+void galeos_sim_trace( galeos_sim_trace_t *trace )
+{
+  if(trace)
+    memset(trace, 0, sizeof(*trace));
+  WRITE_ONCE(galeos_sim->trace, trace);
+}
+EXPORT_SYMBOL_GPL(galeos_sim_trace);
+
+/* Delivered from irq_work, generic_handle_irq() wants hard interrupt context */
+static void galeos_sim_irq_fire( galeos_sim_t *sim, unsigned n )
+{
+  set_bit(n, &sim->irq_pending);
+  irq_work_queue(&sim->irq_work);
+}
+
+static void galeos_sim_irq_work( struct irq_work *work )
+{
+  galeos_sim_t *sim = container_of(work, galeos_sim_t, irq_work);
+  unsigned n;
+
+  for(n = 0; n < sim->irqs; n++)
+  {
+    if(test_and_clear_bit(n, &sim->irq_pending) && !test_bit(n, &sim->irq_masked))
+      generic_handle_irq(sim->irq_base + n);
+  }
+}
+
+static bool galeos_sim_irq_asserted( galeos_sim_t *sim, unsigned n )
+{
+  return n % GALEOS_SIM_IRQS == 0 && READ_ONCE(sim->modem[n / GALEOS_SIM_IRQS].irq_line);
+}
+
+static void galeos_sim_irq_mask( struct irq_data *d )
+{
+  galeos_sim_t *sim = irq_data_get_irq_chip_data(d);
+
+  set_bit(d->irq - sim->irq_base, &sim->irq_masked);
+}
+
+static void galeos_sim_irq_unmask( struct irq_data *d )
+{
+  galeos_sim_t *sim = irq_data_get_irq_chip_data(d);
+  unsigned n = d->irq - sim->irq_base;
+
+  clear_bit(n, &sim->irq_masked);
+  /* a level interrupt still asserted fires again */
+  if(galeos_sim_irq_asserted(sim, n))
+    galeos_sim_irq_fire(sim, n);
+}
+
+static struct irq_chip galeos_sim_irq_chip = {
+  .name       = "galeos-sim",
+  .irq_mask   = galeos_sim_irq_mask,
+  .irq_unmask = galeos_sim_irq_unmask,
+};
+
+/* rdy goes low after accesses more register accesses of the modem, at once for 0 */
+void galeos_sim_drop_rdy( unsigned modem, unsigned accesses )
+{
+  galeos_sim_t *sim = galeos_sim;
+
+  if(accesses)
+  {
+    WRITE_ONCE(sim->modem[modem].rdy_drop, accesses);
+    return;
+  }
+  WRITE_ONCE(sim->modem[modem].rdy_drop, 0);
+  clear_bit(modem * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RDY, &sim->lines);
+}
+EXPORT_SYMBOL_GPL(galeos_sim_drop_rdy);
+
+void galeos_sim_raise_rdy( unsigned modem )
+{
+  galeos_sim_t *sim = galeos_sim;
+
+  WRITE_ONCE(sim->modem[modem].rdy_drop, 0);
+  if(!test_and_set_bit(modem * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RDY, &sim->lines))
+    galeos_sim_irq_fire(sim, GALEOS_SIM_IRQ_RDY(modem));
+}
+EXPORT_SYMBOL_GPL(galeos_sim_raise_rdy);
+
+void galeos_sim_raise_irq( unsigned modem, u8 channels )
+{
+  galeos_sim_t *sim = galeos_sim;
+  galeos_sim_modem_t *m = &sim->modem[modem];
+
+  m->irq |= channels;
+  WRITE_ONCE(m->irq_line, true);
+  galeos_sim_irq_fire(sim, GALEOS_SIM_IRQ(modem));
+}
+EXPORT_SYMBOL_GPL(galeos_sim_raise_irq);
+
+static void galeos_sim_reset( galeos_sim_modem_t *m )
+{
+  unsigned ch;
+
+  memset(m, 0, sizeof(*m));
+  for(ch = 0; ch < GALEOS_PAGES; ch++)
+  {
+    m->regs[ch][GALEOS_REG_MODE] = 0x00;      /* COT */
+    m->regs[ch][GALEOS_REG_SPEED_HI] = 2304 / 64;
+    m->regs[ch][GALEOS_REG_SPEED_LO] = 0;
+    m->regs[ch][GALEOS_REG_PAM] = 16;
+    m->regs[ch][GALEOS_REG_SNR_MARGIN] = 12;
+    m->regs[ch][GALEOS_REG_LATN] = 6;
+  }
+}
+
+/* 0x60..0x63 and the page register are global, everything else is paged */
+static bool galeos_sim_global( u8 reg )
+{
+  return reg == GALEOS_REG_TYPE || reg == GALEOS_REG_VERSION ||
+         reg == GALEOS_REG_IRQ || reg == GALEOS_REG_SCRATCH || reg == GALEOS_REG_PAGE;
+}
+
+static u8 galeos_sim_read( galeos_sim_modem_t *m, u8 reg )
+{
+  u8 value;
+
+  switch(reg)
+  {
+    case GALEOS_REG_TYPE:
+      return type;
+    case GALEOS_REG_VERSION:
+      return version;
+    case GALEOS_REG_PAGE:
+      return m->page;
+    case GALEOS_REG_SCRATCH:
+      return m->scratch;
+    case GALEOS_REG_IRQ:
+      value = m->irq;
+      m->irq = 0;
+      WRITE_ONCE(m->irq_line, false);
+      return value;
+  }
+  if(m->page >= GALEOS_PAGES)
+    return 0xFF;
+  if(reg == GALEOS_REG_STATUS)
+    return m->regs[m->page][GALEOS_REG_MODE] == 0xFF ? GALEOS_STATUS_LOS : GALEOS_STATUS_LINK;
+  /* the line trains to the configured speed */
+  if(reg == GALEOS_REG_RATE_HI || reg == GALEOS_REG_RATE_LO)
+    return m->regs[m->page][GALEOS_REG_MODE] == 0xFF ? 0 :
+           m->regs[m->page][GALEOS_REG_SPEED_HI + reg - GALEOS_REG_RATE_HI];
+  return m->regs[m->page][reg];
+}
+
+static void galeos_sim_write( galeos_sim_modem_t *m, u8 reg, u8 value )
+{
+  if(reg == GALEOS_REG_PAGE)
+  {
+    m->page = value;
+    return;
+  }
+  if(reg == GALEOS_REG_SCRATCH)
+  {
+    m->scratch = value;
+    return;
+  }
+  if(galeos_sim_global(reg) || m->page >= GALEOS_PAGES)
+    return;
+  if(reg == GALEOS_REG_MODE && m->regs[m->page][reg] != value)
+    m->irq |= BIT(m->page);
+  m->regs[m->page][reg] = value;
+}
+
+static int galeos_sim_transfer_one(struct spi_master *master, struct spi_device *spi,
+                                   struct spi_transfer *t)
+{
+  galeos_sim_t *sim = *(galeos_sim_t **)spi_master_get_devdata(master);
+  galeos_sim_modem_t *m = &sim->modem[spi->chip_select];
+  galeos_sim_trace_t *trace = READ_ONCE(sim->trace);
+  bool ac = test_bit(spi->chip_select * GALEOS_SIM_LINES + GALEOS_SIM_LINE_AC, &sim->lines);
+  const u8 *tx = t->tx_buf;
+  u8 *rx = t->rx_buf;
+  unsigned i;
+
+  for(i = 0; i < t->len; i++)
+  {
+    u8 in = tx ? tx[i] : 0;
+    u8 out = 0;
+    u8 page = m->page;
+    if(!ac)
+    {
+      m->addr = in & 0x7F;
+      m->read = (in & 0x80) != 0;
+    }
+    else if(m->read)
+      out = galeos_sim_read(m, m->addr);
+    else
+      galeos_sim_write(m, m->addr, in);
+    if(max_hz && t->speed_hz > max_hz)
+      out ^= 0x01;
+    if(rx)
+      rx[i] = out;
+    if(trace && ac && trace->accesses++ < GALEOS_SIM_LOG_LEN)
+    {
+      galeos_sim_access_t *a = &trace->log[trace->accesses - 1];
+      a->modem = spi->chip_select;
+      a->page = page;
+      a->reg = m->addr;
+      a->value = m->read ? out : in;
+      a->read = m->read;
+    }
+    /* the modem gets busy after a data phase, see galeos_sim_drop_rdy() */
+    if(ac && m->rdy_drop && --m->rdy_drop == 0)
+      clear_bit(spi->chip_select * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RDY, &sim->lines);
+  }
+  sim->transfers++;
+  sim->bytes += t->len;
+  if(trace)
+  {
+    trace->transfers++;
+    if(sim->cs_lines & ~BIT(spi->chip_select))
+      trace->cs_overlaps++;
+  }
+
+  if(latency_us >= 10)
+    usleep_range(latency_us, latency_us + latency_us / 8 + 1);
+  else if(latency_us)
+    udelay(latency_us);
+  return 0;
+}
+
+static int galeos_sim_prepare_message(struct spi_master *master, struct spi_message *msg)
+{
+  galeos_sim_t *sim = *(galeos_sim_t **)spi_master_get_devdata(master);
+  galeos_sim_trace_t *trace = READ_ONCE(sim->trace);
+
+  sim->messages++;
+  if(trace)
+    trace->messages++;
+  return 0;
+}
+
+static void galeos_sim_set_cs(struct spi_device *spi, bool enable)
+{
+  galeos_sim_t *sim = *(galeos_sim_t **)spi_master_get_devdata(spi->master);
+
+  /* enable is the line level */
+  if(enable == !!(spi->mode & SPI_CS_HIGH))
+    set_bit(spi->chip_select, &sim->cs_lines);
+  else
+    clear_bit(spi->chip_select, &sim->cs_lines);
+}
+
+static int galeos_sim_gpio_get(struct gpio_chip *chip, unsigned offset)
+{
+  galeos_sim_t *sim = gpiochip_get_data(chip);
+
+  /* irq is active low */
+  if(offset % GALEOS_SIM_LINES == GALEOS_SIM_LINE_IRQ)
+    return !READ_ONCE(sim->modem[offset / GALEOS_SIM_LINES].irq_line);
+  return test_bit(offset, &sim->lines);
+}
+
+static int galeos_sim_gpio_to_irq(struct gpio_chip *chip, unsigned offset)
+{
+  galeos_sim_t *sim = gpiochip_get_data(chip);
+  unsigned modem = offset / GALEOS_SIM_LINES;
+
+  switch(offset % GALEOS_SIM_LINES)
+  {
+    case GALEOS_SIM_LINE_IRQ:
+      return sim->irq_base + GALEOS_SIM_IRQ(modem);
+    case GALEOS_SIM_LINE_RDY:
+      return sim->irq_base + GALEOS_SIM_IRQ_RDY(modem);
+  }
+  return -ENXIO;
+}
+
+static void galeos_sim_gpio_set(struct gpio_chip *chip, unsigned offset, int value)
+{
+  galeos_sim_t *sim = gpiochip_get_data(chip);
+  unsigned modem = offset / GALEOS_SIM_LINES;
+
+  if(offset % GALEOS_SIM_LINES == GALEOS_SIM_LINE_RESET && !value &&
+     test_bit(offset, &sim->lines))
+    galeos_sim_reset(&sim->modem[modem]);
+  if(value)
+    set_bit(offset, &sim->lines);
+  else
+    clear_bit(offset, &sim->lines);
+}
+
+static int galeos_sim_gpio_direction_input(struct gpio_chip *chip, unsigned offset)
+{
+  return 0;
+}
+
+static int galeos_sim_gpio_direction_output(struct gpio_chip *chip, unsigned offset, int value)
+{
+  galeos_sim_gpio_set(chip, offset, value);
+  return 0;
+}
+
+static int galeos_sim_stats_show( struct seq_file *s, void *unused )
+{
+  galeos_sim_t *sim = s->private;
+  seq_printf(s, "messages: %llu\n", sim->messages);
+  seq_printf(s, "transfers: %llu\n", sim->transfers);
+  seq_printf(s, "bytes: %llu\n", sim->bytes);
+  return 0;
+}
+
+static int galeos_sim_stats_open( struct inode *inode, struct file *file )
+{
+  return single_open(file, galeos_sim_stats_show, inode->i_private);
+}
+
+static ssize_t galeos_sim_stats_write( struct file *file, const char __user *buf,
+                                       size_t count, loff_t *ppos )
+{
+  galeos_sim_t *sim = ((struct seq_file *)file->private_data)->private;
+  sim->messages = 0;
+  sim->transfers = 0;
+  sim->bytes = 0;
+  return count;
+}
+
+static const struct file_operations galeos_sim_stats_fops = {
+  .owner   = THIS_MODULE,
+  .open    = galeos_sim_stats_open,
+  .read    = seq_read,
+  .write   = galeos_sim_stats_write,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static void galeos_sim_cleanup( galeos_sim_t *sim )
+{
+  unsigned i;
+
+  for(i = 0; i < GALEOS_SIM_MAX_MODEMS; i++)
+  {
+    if(sim->spi[i])
+      spi_unregister_device(sim->spi[i]);
+  }
+  if(sim->chip_added)
+    gpiochip_remove(&sim->chip);
+  if(sim->irqs)
+  {
+    irq_work_sync(&sim->irq_work);
+    irq_free_descs(sim->irq_base, sim->irqs);
+  }
+  if(sim->master)
+    spi_unregister_master(sim->master);
+  if(sim->pdev)
+    platform_device_unregister(sim->pdev);
+  debugfs_remove_recursive(sim->debugfs);
+  kfree(sim);
+}
+
+static int __init galeos_sim_init(void)
+{
+  galeos_sim_t *sim;
+  struct spi_master *master;
+  unsigned i;
+  int ret;
+
+  if(modems == 0 || modems > GALEOS_SIM_MAX_MODEMS)
+    return -EINVAL;
+  sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+  if(!sim)
+    return -ENOMEM;
+  for(i = 0; i < modems; i++)
+    galeos_sim_reset(&sim->modem[i]);
+  // gpio-ac and reset are idle high, the modems are ready
+  for(i = 0; i < modems; i++)
+  {
+    set_bit(i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_AC, &sim->lines);
+    set_bit(i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RESET, &sim->lines);
+    set_bit(i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RDY, &sim->lines);
+  }
+
+  sim->pdev = platform_device_register_simple("galeos-sim", -1, NULL, 0);
+  if(IS_ERR(sim->pdev))
+  {
+    ret = PTR_ERR(sim->pdev);
+    sim->pdev = NULL;
+    goto fail;
+  }
+
+  // Interrupts of the irq and rdy lines, masked until requested
+  init_irq_work(&sim->irq_work, galeos_sim_irq_work);
+  sim->irq_base = irq_alloc_descs(-1, 0, modems * GALEOS_SIM_IRQS, NUMA_NO_NODE);
+  if(sim->irq_base < 0)
+  {
+    ret = sim->irq_base;
+    goto fail;
+  }
+  sim->irqs = modems * GALEOS_SIM_IRQS;
+  sim->irq_masked = BIT(sim->irqs) - 1;
+  for(i = 0; i < sim->irqs; i++)
+  {
+    irq_set_chip_data(sim->irq_base + i, sim);
+    irq_set_chip_and_handler(sim->irq_base + i, &galeos_sim_irq_chip,
+                             i % GALEOS_SIM_IRQS ? handle_simple_irq : handle_level_irq);
+    irq_modify_status(sim->irq_base + i, IRQ_NOREQUEST | IRQ_NOAUTOEN, IRQ_NOPROBE);
+  }
+
+  // Fake gpiochip with the modem control lines
+  sim->chip.label = "galeos-sim";
+  sim->chip.owner = THIS_MODULE;
+  sim->chip.parent = &sim->pdev->dev;
+  sim->chip.base = -1;
+  sim->chip.ngpio = modems * GALEOS_SIM_LINES;
+  sim->chip.get = galeos_sim_gpio_get;
+  sim->chip.to_irq = galeos_sim_gpio_to_irq;
+  sim->chip.set = galeos_sim_gpio_set;
+  sim->chip.direction_input = galeos_sim_gpio_direction_input;
+  sim->chip.direction_output = galeos_sim_gpio_direction_output;
+  ret = gpiochip_add_data(&sim->chip, sim);
+  if(ret)
+    goto fail;
+  sim->chip_added = true;
+
+  // Virtual SPI controller
+  master = spi_alloc_master(&sim->pdev->dev, sizeof(galeos_sim_t *));
+  if(!master)
+  {
+    ret = -ENOMEM;
+    goto fail;
+  }
+  *(galeos_sim_t **)spi_master_get_devdata(master) = sim;
+  master->bus_num = bus_num;
+  master->num_chipselect = modems;
+  master->mode_bits = SPI_CPOL | SPI_CPHA | SPI_CS_HIGH;
+  master->max_speed_hz = 100000000;
+  master->transfer_one = galeos_sim_transfer_one;
+  master->prepare_message = galeos_sim_prepare_message;
+  master->set_cs = galeos_sim_set_cs;
+  ret = spi_register_master(master);
+  if(ret)
+  {
+    spi_master_put(master);
+    goto fail;
+  }
+  sim->master = master;
+
+  sim->debugfs = debugfs_create_dir("galeos-sim", NULL);
+  if(!IS_ERR_OR_NULL(sim->debugfs))
+    debugfs_create_file("stats", S_IRUSR | S_IWUSR, sim->debugfs, sim, &galeos_sim_stats_fops);
+
+  // Board info binding the galeos driver to every simulated modem
+  for(i = 0; i < modems; i++)
+  {
+    struct spi_board_info info = {
+      .modalias      = GALEOS_DRIVER_NAME,
+      .max_speed_hz  = master->max_speed_hz,
+      .chip_select   = i,
+      .mode          = SPI_MODE_0,
+      .platform_data = &sim->pdata[i],
+    };
+    sim->pdata[i].spi_speed_hz = speed_hz;
+    sim->pdata[i].gpio_ac = sim->chip.base + i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_AC;
+    sim->pdata[i].gpio_reset = sim->chip.base + i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RESET;
+    sim->pdata[i].gpio_irq = sim->chip.base + i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_IRQ;
+    sim->pdata[i].gpio_rdy = sim->chip.base + i * GALEOS_SIM_LINES + GALEOS_SIM_LINE_RDY;
+    sim->spi[i] = spi_new_device(master, &info);
+    if(!sim->spi[i])
+    {
+      ret = -ENODEV;
+      goto fail;
+    }
+  }
+
+  galeos_sim = sim;
+  printk(KERN_INFO "Galeos simulator: %u modem(s) on SPI bus %d\n", modems, master->bus_num);
+  return 0;
+
+fail:
+  galeos_sim_cleanup(sim);
+  return ret;
+}
+
+static void __exit galeos_sim_exit(void)
+{
+  galeos_sim_cleanup(galeos_sim);
+}
+
+module_init(galeos_sim_init);
+module_exit(galeos_sim_exit);
@@ -1,19 +1,30 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
 #include <linux/init.h>             // Macros used to mark up functions e.g., __init __exit
 #include <linux/module.h>           // Core header for loading LKMs into the kernel
 #include <linux/fs.h>
 
 #include "galeos.h"
+#define CREATE_TRACE_POINTS
+#include "galeos_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Dmitriy Vakhrushev");
 MODULE_DESCRIPTION("The galeos shdsl modem Linux driver.");
 MODULE_VERSION("0.1");
 
-static int users = 0;
 static int major = 0;
-static unsigned int reg = 0;
 
 module_param( major, int, S_IRUGO );
+static unsigned int poll_interval = 0;
+module_param( poll_interval, uint, S_IRUGO );
+MODULE_PARM_DESC(poll_interval, "Default status poll interval in ms, 0 disables the poller");
+static bool pm_collect = false;
+module_param( pm_collect, bool, S_IRUGO );
+MODULE_PARM_DESC(pm_collect, "Collect SHDSL performance monitoring history (8 reads per modem per second)");
+static unsigned int spi_recheck = 0;
+module_param( spi_recheck, uint, S_IRUGO );
+MODULE_PARM_DESC(spi_recheck, "SPI clock re-check interval in s, lowers the clock on read-back errors, 0 disables");
 static DECLARE_BITMAP(minors, 32);
 
 static LIST_HEAD(device_list);
@@ -28,395 +39,3340 @@ static struct of_device_id galeos_of_match[] = {
 };
 MODULE_DEVICE_TABLE(of, galeos_of_match);
 
-static void galeos_register_write( galeosdev_data_t *dev, u8 reg, u8 value )
+static struct dentry *galeos_debugfs_root;
+
+static void galeos_hist_add( u64 *hist, s64 ns )
+{
+  unsigned bucket = ns > 1 ? ilog2((u64)ns) : 0;
+  if(bucket >= GALEOS_HIST_BUCKETS)
+    bucket = GALEOS_HIST_BUCKETS - 1;
+  hist[bucket]++;
+}
+
+/*
+ * Transfer engine. Every register access is an address phase (gpio_ac low)
+ * followed by a data phase (gpio_ac high), with chip select held from one
+ * to the other. Which request goes on the wire is up to the scheduler of
+ * the SPI bus (galeos_bus_t): one request or bulk slice per controller at
+ * a time, so a bulk transfer never has a queue of its messages in the SPI
+ * core ahead of an alarm read of a neighbouring modem. The request on the
+ * wire runs in dev->xfer_work, which holds the SPI bus lock for its slice:
+ * no message of another device can run while chip select is held between
+ * the phases, and the phases go out through spi_sync_locked() without
+ * queueing in the SPI core.
+ */
+static void galeos_work_init( galeos_work_t *gw, galeosdev_data_t *dev,
+                              struct galeos_reg_op *ops, unsigned count )
+{
+  memset(gw, 0, sizeof(*gw));
+  INIT_LIST_HEAD(&gw->entry);
+  init_completion(&gw->done);
+  gw->gdata = dev;
+  gw->ops = ops;
+  gw->count = count;
+}
+
+/* One phase of the access selected by galeos_xfer_next(), called with the bus locked */
+static int galeos_xfer_phase( galeosdev_data_t *dev, galeos_work_t *gw, bool addr )
+{
+  struct spi_transfer *t = &dev->spi_transfer[0];
+  struct spi_message  *m = &dev->spi_message;
+  u8 * data = dev->xfer_buf;
+  bool read = dev->xfer_op && dev->xfer_op->op == GALEOS_OP_READ;
+
+  spi_message_init(m);
+  memset(t, 0, sizeof(*t));
+  if(addr)
+  {
+    data[0] = read ? (dev->xfer_reg | 0x80) : (dev->xfer_reg & 0x7F);
+    gpio_set_value(dev->gpio_ac,0);
+    /* chip select stays asserted for the data phase */
+    t->cs_change = 1;
+    t->tx_buf = &data[0];
+  }
+  else
+  {
+    gpio_set_value(dev->gpio_ac,1);
+    t->cs_change = 0;
+    if(read)
+    {
+      t->tx_buf = &data[0];
+      t->rx_buf = &data[GALEOS_XFER_RX];
+    }
+    else
+    {
+      data[0] = dev->xfer_value;
+      t->tx_buf = &data[0];
+    }
+  }
+  t->len = 1;
+  t->speed_hz = dev->spi_speed_hz;
+  spi_message_add_tail(t, m);
+  return spi_sync_locked(gw->spi, m);
+}
+
+/* Deassert chip select after an access that stopped between its phases */
+static void galeos_xfer_release_cs( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  struct spi_transfer *t = &dev->spi_transfer[0];
+  struct spi_message  *m = &dev->spi_message;
+
+  spi_message_init(m);
+  memset(t, 0, sizeof(*t));
+  spi_message_add_tail(t, m);
+  spi_sync_locked(gw->spi, m);
+}
+
+/*
+ * Select the next register access of the in-flight request: the page a
+ * failed request could not restore, a page switch, the operation itself
+ * or the final page restore. Returns false once the request, or the
+ * current slice of it, is complete.
+ */
+static bool galeos_xfer_next( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  struct galeos_reg_op *op;
+
+  dev->xfer_op = NULL;
+  if(dev->xfer_resync != GALEOS_PAGE_NONE)
+  {
+    dev->xfer_reg = GALEOS_REG_PAGE;
+    dev->xfer_value = dev->xfer_resync;
+    return true;
+  }
+  if(gw->pos < gw->count)
+  {
+    if(gw->pos >= gw->slice_end)
+      return false;
+    op = &gw->ops[gw->pos];
+    if(op->page != GALEOS_PAGE_NONE && op->page != dev->xfer_page)
+    {
+      dev->xfer_reg = GALEOS_REG_PAGE;
+      dev->xfer_value = op->page;
+      return true;
+    }
+    dev->xfer_op = op;
+    dev->xfer_reg = op->reg;
+    dev->xfer_value = op->value;
+    return true;
+  }
+  if(gw->restore_page != GALEOS_PAGE_NONE && gw->restore_page != dev->xfer_page)
+  {
+    dev->xfer_reg = GALEOS_REG_PAGE;
+    dev->xfer_value = gw->restore_page;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Per-bus scheduler. Takes the next request for the wire, interactive
+ * ones first, and books its queue wait. Requests of a modem that is
+ * parked on gpio_rdy are left in place. Called with bus->lock held.
+ */
+static galeos_work_t *galeos_bus_pick( galeos_bus_t *bus )
+{
+  galeos_prio_stats_t *st;
+  galeos_work_t *gw = NULL, *it;
+  unsigned prio;
+  s64 wait;
+
+  for(prio = 0; prio < GALEOS_PRIOS && !gw; prio++)
+  {
+    list_for_each_entry(it, &bus->queue[prio], entry)
+    {
+      if(!it->gdata->xfer_parked)
+      {
+        gw = it;
+        break;
+      }
+    }
+    if(!gw)
+      continue;
+    list_del_init(&gw->entry);
+    st = &bus->stats[prio];
+    wait = ktime_to_ns(ktime_sub(ktime_get(), gw->waiting));
+    st->depth--;
+    st->dispatched++;
+    st->wait_ns += wait;
+    st->max_wait_ns = max_t(u64, st->max_wait_ns, wait);
+  }
+  bus->cur = gw;
+  return gw;
+}
+
+/* Queue a request, or the rest of a sliced one, called with bus->lock held */
+static void galeos_bus_add( galeos_bus_t *bus, galeos_work_t *gw, bool head )
+{
+  galeos_prio_stats_t *st = &bus->stats[gw->prio];
+
+  gw->waiting = ktime_get();
+  if(head)
+    list_add(&gw->entry, &bus->queue[gw->prio]);
+  else
+    list_add_tail(&gw->entry, &bus->queue[gw->prio]);
+  st->depth++;
+  st->max_depth = max(st->max_depth, st->depth);
+}
+
+/* Book a finished request and notify its owner */
+static void galeos_xfer_done( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  s64 ns;
+
+  dev->stats.requests++;
+  if(gw->status)
+    dev->stats.errors++;
+  ns = ktime_to_ns(ktime_sub(ktime_get(), gw->queued));
+  galeos_hist_add(dev->stats.request_hist, ns);
+  trace_galeos_request(dev->device, gw->count, gw->status, ns);
+
+  /* gw may be released by its owner once it has been notified */
+  complete(&gw->done);
+  if(atomic_dec_and_test(&dev->xfer_pending))
+    wake_up_all(&dev->xfer_idle);
+}
+
+/* The request or slice on the wire is over, give the bus up */
+static void galeos_xfer_end( galeosdev_data_t *dev )
+{
+  galeos_work_t *gw = dev->xfer_cur;
+  galeos_bus_t *bus = dev->bus;
+  bool done = gw->status || gw->pos >= gw->count;
+  unsigned long flags;
+
+  dev->xfer_cur = NULL;
+  spin_lock_irqsave(&bus->lock, flags);
+  if(!done)
+    galeos_bus_add(bus, gw, false);
+  bus->cur = NULL;
+  spin_unlock_irqrestore(&bus->lock, flags);
+
+  if(done)
+    galeos_xfer_done(dev, gw);
+}
+
+static void galeos_xfer_begin( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  unsigned i;
+
+  dev->xfer_cur = gw;
+  /* paged requests leave the modem on the page they found it on */
+  if(gw->slice_end == 0)
+  {
+    gw->restore_page = GALEOS_PAGE_NONE;
+    for(i = 0; i < gw->count; i++)
+    {
+      if(gw->ops[i].page != GALEOS_PAGE_NONE)
+      {
+        /* the page regmap has cached for the selector */
+        gw->restore_page = dev->xfer_resync != GALEOS_PAGE_NONE ? dev->xfer_resync : dev->xfer_page;
+        break;
+      }
+    }
+  }
+  gw->slice_end = gw->prio == GALEOS_PRIO_BULK ? min(gw->pos + GALEOS_SLICE_OPS, gw->count) : gw->count;
+  queue_work(system_unbound_wq, &dev->xfer_work);
+}
+
+/* Put the next request on the wire if the bus is free, from any context */
+static void galeos_bus_run( galeos_bus_t *bus )
+{
+  galeos_work_t *gw;
+  unsigned long flags;
+
+  spin_lock_irqsave(&bus->lock, flags);
+  gw = bus->cur ? NULL : galeos_bus_pick(bus);
+  spin_unlock_irqrestore(&bus->lock, flags);
+  if(gw)
+    galeos_xfer_begin(gw->gdata, gw);
+}
+
+/*
+ * Flow control on gpio_rdy, which the modem drops while it is busy. Every
+ * phase goes out once rdy is high. Before an access, after a short busy
+ * wait, the request is parked: it keeps its place in dev->xfer_cur but
+ * gives the bus to the other modems, goes back to the head of its queue
+ * on the rising edge of rdy and fails when rdy is still low after
+ * GALEOS_RDY_TIMEOUT_MS. Between the two phases of an access chip select
+ * is asserted, so the wait stays on the bus and is bounded by
+ * GALEOS_RDY_PHASE_MS. Without the rdy interrupt phases are sent back to
+ * back as before.
+ */
+static bool galeos_rdy_spin( galeosdev_data_t *dev )
+{
+  unsigned us;
+
+  for(us = 0; us < GALEOS_RDY_SPIN_US; us++)
+  {
+    if(gpio_get_value(dev->gpio_rdy))
+      return true;
+    udelay(1);
+  }
+  return false;
+}
+
+static void galeos_xfer_park( galeosdev_data_t *dev, bool parked )
+{
+  galeos_bus_t *bus = dev->bus;
+  unsigned long flags;
+
+  spin_lock_irqsave(&bus->lock, flags);
+  dev->xfer_parked = parked;
+  if(parked)
+    bus->cur = NULL;
+  else
+    galeos_bus_add(bus, dev->xfer_cur, true);
+  spin_unlock_irqrestore(&bus->lock, flags);
+}
+
+/* Wait for rdy before an access, true when the request was parked */
+static bool galeos_xfer_gate( galeosdev_data_t *dev )
+{
+  if(!dev->rdy_irq || galeos_rdy_spin(dev))
+    return false;
+  dev->stats.rdy_waits++;
+  galeos_xfer_park(dev, true);
+  atomic_set(&dev->rdy_armed, 1);
+  mod_timer(&dev->rdy_timer, jiffies + msecs_to_jiffies(GALEOS_RDY_TIMEOUT_MS));
+  /* the edge may have passed before the wait was armed */
+  if(gpio_get_value(dev->gpio_rdy) && atomic_xchg(&dev->rdy_armed, 0))
+  {
+    del_timer(&dev->rdy_timer);
+    galeos_xfer_park(dev, false);
+  }
+  return true;
+}
+
+/* Wait for rdy between the phases of an access, with the bus held */
+static int galeos_xfer_gate_phase( galeosdev_data_t *dev )
+{
+  if(!dev->rdy_irq || galeos_rdy_spin(dev))
+    return 0;
+  dev->stats.rdy_waits++;
+  if(wait_event_timeout(dev->rdy_wait, gpio_get_value(dev->gpio_rdy),
+                        msecs_to_jiffies(GALEOS_RDY_PHASE_MS)))
+    return 0;
+  dev->stats.rdy_timeouts++;
+  dev_warn_ratelimited(dev->device, "modem not ready for the data phase after %d ms\n",
+                       GALEOS_RDY_PHASE_MS);
+  return -ETIMEDOUT;
+}
+
+static irqreturn_t galeos_rdy_irq( int irq, void *data )
+{
+  galeosdev_data_t *dev = data;
+
+  wake_up(&dev->rdy_wait);
+  if(!atomic_xchg(&dev->rdy_armed, 0))
+    return IRQ_HANDLED;
+  del_timer(&dev->rdy_timer);
+  galeos_xfer_park(dev, false);
+  galeos_bus_run(dev->bus);
+  return IRQ_HANDLED;
+}
+
+static void galeos_rdy_timeout( struct timer_list *t )
+{
+  galeosdev_data_t *dev = from_timer(dev, t, rdy_timer);
+  galeos_bus_t *bus = dev->bus;
+  galeos_work_t *gw;
+  unsigned long flags;
+
+  if(!atomic_xchg(&dev->rdy_armed, 0))
+    return;
+  dev->stats.rdy_timeouts++;
+  dev_warn_ratelimited(dev->device, "modem not ready after %d ms\n", GALEOS_RDY_TIMEOUT_MS);
+  gw = dev->xfer_cur;
+  dev->xfer_cur = NULL;
+  spin_lock_irqsave(&bus->lock, flags);
+  dev->xfer_parked = false;
+  spin_unlock_irqrestore(&bus->lock, flags);
+  gw->status = -ETIMEDOUT;
+  /* no SPI from here, the next request puts the page back */
+  if(gw->restore_page != GALEOS_PAGE_NONE && gw->restore_page != dev->xfer_page)
+  {
+    dev->xfer_page = GALEOS_PAGE_NONE;
+    dev->xfer_resync = gw->restore_page;
+  }
+  galeos_xfer_done(dev, gw);
+  /* requests of this modem that were passed over while it was parked */
+  galeos_bus_run(bus);
+}
+
+/* Book a completed register access: statistics, page tracking and the op value */
+static void galeos_xfer_account( galeosdev_data_t *dev, galeos_work_t *gw,
+                                 struct galeos_reg_op *op, u8 reg, u8 value, s64 ns )
+{
+  bool read = op && op->op == GALEOS_OP_READ;
+
+  galeos_hist_add(dev->stats.access_hist, ns);
+  trace_galeos_reg_access(dev->device, dev->xfer_page, reg, value, read, ns);
+  if(read)
+    dev->stats.reads++;
+  else
+    dev->stats.writes++;
+  if(reg == GALEOS_REG_PAGE)
+  {
+    if(!read && value != dev->xfer_page)
+    {
+      dev->stats.page_switches++;
+      trace_galeos_page_switch(dev->device, dev->xfer_page, value);
+    }
+    dev->xfer_page = value;
+    dev->xfer_resync = GALEOS_PAGE_NONE;
+  }
+  if(op)
+  {
+    op->value = value;
+    gw->pos++;
+  }
+}
+
+/* The access selected by galeos_xfer_next(), called with the bus locked */
+static int galeos_xfer_access( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  ktime_t start = ktime_get();
+  u8 value;
+  int status;
+
+  status = galeos_xfer_phase(dev, gw, true);
+  if(status == 0)
+    status = galeos_xfer_gate_phase(dev);
+  if(status)
+  {
+    galeos_xfer_release_cs(dev, gw);
+    return status;
+  }
+  status = galeos_xfer_phase(dev, gw, false);
+  if(status)
+    return status;
+  if(dev->xfer_op && dev->xfer_op->op == GALEOS_OP_READ)
+    value = dev->xfer_buf[GALEOS_XFER_RX];
+  else
+    value = dev->xfer_value;
+  galeos_xfer_account(dev, gw, dev->xfer_op, dev->xfer_reg, value,
+                      ktime_to_ns(ktime_sub(ktime_get(), start)));
+  return 0;
+}
+
+/*
+ * A request that failed after switching pages still puts the modem back
+ * on its start page: regmap addresses the 0x00..0x7F window by the page it
+ * has cached for the selector. The regmap lock may be held by the waiting
+ * caller, so the cache can't be dropped from here; if the restore fails
+ * too, the next request of the modem selects the page first instead.
+ */
+static void galeos_xfer_recover( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  /* a page switch that failed may or may not have reached the modem */
+  if(dev->xfer_reg == GALEOS_REG_PAGE && !(dev->xfer_op && dev->xfer_op->op == GALEOS_OP_READ))
+    dev->xfer_page = GALEOS_PAGE_NONE;
+  if(gw->restore_page == GALEOS_PAGE_NONE || gw->restore_page == dev->xfer_page)
+    return;
+  dev->xfer_op = NULL;
+  dev->xfer_reg = GALEOS_REG_PAGE;
+  dev->xfer_value = gw->restore_page;
+  if(galeos_xfer_gate_phase(dev) == 0 && galeos_xfer_access(dev, gw) == 0)
+    return;
+  dev->xfer_page = GALEOS_PAGE_NONE;
+  dev->xfer_resync = gw->restore_page;
+}
+
+/*
+ * A bulk request whose slice is done carries on into its next slice
+ * while no other request waits for the bus, without giving the bus
+ * lock up in between.
+ */
+static bool galeos_xfer_extend( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  galeos_bus_t *bus = dev->bus;
+  unsigned long flags;
+  unsigned prio;
+  bool idle = true;
+
+  if(gw->pos >= gw->count)
+    return false;
+  spin_lock_irqsave(&bus->lock, flags);
+  for(prio = 0; prio < GALEOS_PRIOS; prio++)
+    idle = idle && list_empty(&bus->queue[prio]);
+  spin_unlock_irqrestore(&bus->lock, flags);
+  if(!idle)
+    return false;
+  gw->slice_end = min(gw->pos + GALEOS_SLICE_OPS, gw->count);
+  return galeos_xfer_next(dev, gw);
+}
+
+/* Run the request or slice on the wire, see galeos_xfer_begin() */
+static void galeos_xfer_work( struct work_struct *work )
+{
+  galeosdev_data_t *dev = container_of(work, galeosdev_data_t, xfer_work);
+  galeos_work_t *gw = dev->xfer_cur;
+  struct spi_master *master = gw->spi->master;
+  int status = 0;
+
+  spi_bus_lock(master);
+  while(galeos_xfer_next(dev, gw) || galeos_xfer_extend(dev, gw))
+  {
+    if(galeos_xfer_gate(dev))
+    {
+      /* parked, gw belongs to the rdy edge or timeout now */
+      spi_bus_unlock(master);
+      galeos_bus_run(dev->bus);
+      return;
+    }
+    status = galeos_xfer_access(dev, gw);
+    if(status)
+    {
+      galeos_xfer_recover(dev, gw);
+      break;
+    }
+  }
+  spi_bus_unlock(master);
+
+  if(status)
+    gw->status = status;
+  galeos_xfer_end(dev);
+  galeos_bus_run(dev->bus);
+}
+
+/*
+ * Queue a request, completion is signalled through gw->done. Callers
+ * submit one request and wait for it in galeos_xfer_sync(); modems are
+ * driven in parallel by their own callers, e.g. the fleet workqueue.
+ * Writes to cached channel registers must go through regmap instead,
+ * this path bypasses the register cache.
+ */
+static int galeos_submit( galeosdev_data_t *dev, galeos_work_t *gw )
+{
+  galeos_bus_t *bus = dev->bus;
+  unsigned long flags;
+  unsigned i;
+
+  for(i = 0; i < gw->count; i++)
+  {
+    struct galeos_reg_op *op = &gw->ops[i];
+    if(op->reg > GALEOS_REG_PAGE || (op->page != GALEOS_PAGE_NONE && op->page >= GALEOS_PAGES))
+      return -EINVAL;
+  }
+
+  spin_lock_irqsave(&dev->spin_lock, flags);
+  gw->spi = dev->spi;
+  if(gw->spi == NULL)
+  {
+    spin_unlock_irqrestore(&dev->spin_lock, flags);
+    return -ESHUTDOWN;
+  }
+  gw->gdata = dev;
+  gw->pos = 0;
+  gw->slice_end = 0;
+  gw->status = 0;
+  gw->queued = ktime_get();
+  reinit_completion(&gw->done);
+  atomic_inc(&dev->xfer_pending);
+  spin_unlock_irqrestore(&dev->spin_lock, flags);
+
+  spin_lock_irqsave(&bus->lock, flags);
+  bus->stats[gw->prio].queued++;
+  galeos_bus_add(bus, gw, false);
+  spin_unlock_irqrestore(&bus->lock, flags);
+
+  galeos_bus_run(bus);
+  return 0;
+}
+
+static int galeos_wait( galeos_work_t *gw )
+{
+  wait_for_completion(&gw->done);
+  return gw->status;
+}
+
+static int galeos_xfer_sync( galeosdev_data_t *dev, struct galeos_reg_op *ops, unsigned count )
+{
+  galeos_work_t gw;
+  int status;
+
+  galeos_work_init(&gw, dev, ops, count);
+  /* bulk operations of the spi_lock holder yield the bus to interactive requests */
+  if(READ_ONCE(dev->bulk_task) == current)
+    gw.prio = GALEOS_PRIO_BULK;
+  status = galeos_submit(dev, &gw);
+  if(status == 0)
+    status = galeos_wait(&gw);
+  return status;
+}
+
+/*
+ * regmap bus. Paging through 0x7F is handled by regmap, so the bus only
+ * sees physical registers; multi-value transfers are split into
+ * sequential single register accesses, issued as one engine request.
+ * The ops of that request live in dev->regmap_ops, calls into the bus
+ * are serialized by the regmap lock.
+ */
+static int galeos_regmap_write(void *context, const void *data, size_t count)
+{
+  galeosdev_data_t *dev = context;
+  struct galeos_reg_op *ops = dev->regmap_ops;
+  const u8 *buf = data;
+  size_t i, n;
+  int status = 0;
+
+  if(count < 2)
+    return -EINVAL;
+  for(i = 1; i < count && status == 0; i += n)
+  {
+    for(n = 0; n < GALEOS_REGMAP_CHUNK && i + n < count; n++)
+    {
+      ops[n].page = GALEOS_PAGE_NONE;
+      ops[n].reg = buf[0] + i + n - 1;
+      ops[n].value = buf[i + n];
+      ops[n].op = GALEOS_OP_WRITE;
+    }
+    status = galeos_xfer_sync(dev, ops, n);
+  }
+  return status;
+}
+
+static int galeos_regmap_read(void *context, const void *reg_buf, size_t reg_size,
+                              void *val_buf, size_t val_size)
+{
+  galeosdev_data_t *dev = context;
+  struct galeos_reg_op *ops = dev->regmap_ops;
+  u8 reg = *(const u8 *)reg_buf & 0x7F;
+  u8 *val = val_buf;
+  size_t i, n;
+  int status = 0;
+
+  if(reg_size != 1)
+    return -EINVAL;
+  for(i = 0; i < val_size && status == 0; i += n)
+  {
+    for(n = 0; n < GALEOS_REGMAP_CHUNK && i + n < val_size; n++)
+    {
+      ops[n].page = GALEOS_PAGE_NONE;
+      ops[n].reg = reg + i + n;
+      ops[n].value = 0;
+      ops[n].op = GALEOS_OP_READ;
+    }
+    status = galeos_xfer_sync(dev, ops, n);
+    for(n = 0; status == 0 && n < GALEOS_REGMAP_CHUNK && i + n < val_size; n++)
+      val[i + n] = ops[n].value;
+  }
+  return status;
+}
+
+static struct regmap_bus galeos_regmap_bus = {
+  .write = galeos_regmap_write,
+  .read  = galeos_regmap_read,
+};
+
+static bool galeos_chan_param_volatile( unsigned int offset );
+
+static bool galeos_volatile_reg(struct device *dev, unsigned int reg)
+{
+  if(reg == GALEOS_REG_PAGE)
+    return false;
+  /* direct window accesses depend on the selected page */
+  if(reg < GALEOS_PAGED_BASE)
+    return true;
+  return galeos_chan_param_volatile(GALEOS_PAGED_OFFSET(reg));
+}
+
+static bool galeos_writeable_reg(struct device *dev, unsigned int reg)
+{
+  /* the page register seen through a window would bypass page tracking */
+  return reg < GALEOS_PAGED_BASE || GALEOS_PAGED_OFFSET(reg) != GALEOS_REG_PAGE;
+}
+
+static const struct regmap_range_cfg galeos_regmap_ranges[] = {
+  {
+    .name           = "channel",
+    .range_min      = GALEOS_PAGED_BASE,
+    .range_max      = GALEOS_MAX_REGISTER,
+    .selector_reg   = GALEOS_REG_PAGE,
+    .selector_mask  = 0xFF,
+    .selector_shift = 0,
+    .window_start   = 0,
+    .window_len     = GALEOS_PAGE_LEN,
+  },
+};
+
+static const struct regmap_config galeos_regmap_config = {
+  .reg_bits       = 8,
+  .val_bits       = 8,
+  .read_flag_mask = 0x80,
+  .max_register   = GALEOS_MAX_REGISTER,
+  .volatile_reg   = galeos_volatile_reg,
+  .writeable_reg  = galeos_writeable_reg,
+  .cache_type     = REGCACHE_RBTREE,
+  .ranges         = galeos_regmap_ranges,
+  .num_ranges     = ARRAY_SIZE(galeos_regmap_ranges),
+};
+
+/*
+ * Status snapshot taken by the background poller. While polling is
+ * enabled, the DSL attributes are served from it instead of the modem.
+ */
+static bool galeos_snapshot_get( galeosdev_data_t *dev, galeos_snapshot_t *snap )
+{
+  unsigned seq;
+
+  if(READ_ONCE(dev->poll_interval) == 0)
+    return false;
+  do {
+    seq = read_seqbegin(&dev->snap_lock);
+    *snap = dev->snap;
+  } while(read_seqretry(&dev->snap_lock, seq));
+  return snap->valid;
+}
+
+/*
+ * Updates of the live status page (struct galeos_live), if it could be
+ * allocated. Readers in userspace follow seq like a seqcount. Writers
+ * come from process context, also nested in dev->spin_lock with
+ * interrupts off, so live_lock is always taken with interrupts off.
+ */
+static void galeos_live_begin( galeosdev_data_t *dev, unsigned long *flags )
+{
+  spin_lock_irqsave(&dev->live_lock, *flags);
+  WRITE_ONCE(dev->live->seq, dev->live->seq + 1);
+  smp_wmb();
+}
+
+static void galeos_live_end( galeosdev_data_t *dev, unsigned long flags )
+{
+  dev->live->stamp_ns = ktime_get_ns();
+  smp_wmb();
+  WRITE_ONCE(dev->live->seq, dev->live->seq + 1);
+  spin_unlock_irqrestore(&dev->live_lock, flags);
+}
+
+/* A configuration register of a channel, inside galeos_live_begin/end */
+static void galeos_live_config( struct galeos_live_chan *lc, u8 reg, u8 value )
+{
+  u32 speed = lc->speed;
+
+  switch(reg)
+  {
+    case GALEOS_REG_MODE:
+      if(lc->mode == value)
+        return;
+      lc->mode = value;
+      break;
+    case GALEOS_REG_SPEED_HI:
+      speed = value * 64 + speed % 64;
+      break;
+    case GALEOS_REG_SPEED_LO:
+      speed = speed - speed % 64 + value * 8;
+      break;
+    case GALEOS_REG_PAM:
+      if(lc->pam == value)
+        return;
+      lc->pam = value;
+      break;
+    default:
+      return;
+  }
+  if(reg == GALEOS_REG_SPEED_HI || reg == GALEOS_REG_SPEED_LO)
+  {
+    if(lc->speed == speed)
+      return;
+    lc->speed = speed;
+  }
+  lc->seq++;
+}
+
+/* Keep the snapshot in step with a register the driver wrote to the modem */
+static void galeos_snapshot_track( galeosdev_data_t *dev, unsigned int vreg, u8 value )
+{
+  galeos_chan_snap_t *chan;
+  unsigned long flags;
+
+  if(vreg < GALEOS_PAGED_BASE)
+    return;
+  if(dev->live)
+  {
+    galeos_live_begin(dev, &flags);
+    galeos_live_config(&dev->live->chan[GALEOS_PAGED_PAGE(vreg)], GALEOS_PAGED_OFFSET(vreg), value);
+    galeos_live_end(dev, flags);
+  }
+  chan = &dev->snap.chan[GALEOS_PAGED_PAGE(vreg)];
+  write_seqlock(&dev->snap_lock);
+  switch(GALEOS_PAGED_OFFSET(vreg))
+  {
+    case GALEOS_REG_MODE:     chan->mode = value; break;
+    case GALEOS_REG_SPEED_HI: chan->speed_hi = value; break;
+    case GALEOS_REG_SPEED_LO: chan->speed_lo = value; break;
+    case GALEOS_REG_PAM:      chan->pam = value; break;
+  }
+  write_sequnlock(&dev->snap_lock);
+}
+
+/*
+ * spi_lock serializes multi-register transactions of sysfs, ioctl and
+ * the other register users; the wait for it is accounted in the stats.
+ * Users arriving while the modem is still brought up wait for it first.
+ */
+static void galeos_lock( galeosdev_data_t *dev )
+{
+  ktime_t start = ktime_get();
+  s64 wait;
+
+  wait_for_completion(&dev->init_done);
+  mutex_lock(&dev->spi_lock);
+  wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+  dev->stats.lock_acquisitions++;
+  dev->stats.lock_wait_ns += wait;
+  galeos_hist_add(dev->stats.lock_hist, wait);
+  trace_galeos_lock(dev->device, wait);
+}
+
+static void galeos_unlock( galeosdev_data_t *dev )
+{
+  mutex_unlock(&dev->spi_lock);
+}
+
+/*
+ * Write-back mode. Writes to cached channel registers only land in the
+ * wb_val shadow; writing a register again before the flush replaces the
+ * held value. The flush sends all held registers in one engine request,
+ * page by page with the mode register last on each page so a line
+ * retrains once, and then updates the register cache. It runs from the
+ * commit attribute, wb_delay ms after the first held write, and before
+ * volatile reads and raw register accesses. Called with spi_lock held.
+ */
+#define GALEOS_WB_BATCH (GALEOS_PAGES * 8)
+
+static bool galeos_wb_holds( galeosdev_data_t *dev, unsigned int reg )
+{
+  return dev->wb_delay && reg >= GALEOS_PAGED_BASE && reg <= GALEOS_MAX_REGISTER &&
+         galeos_writeable_reg(NULL, reg) && !galeos_volatile_reg(NULL, reg);
+}
+
+static int galeos_wb_send( galeosdev_data_t *dev, struct galeos_reg_op *ops, unsigned count )
+{
+  unsigned i;
+  int status;
+
+  status = galeos_xfer_sync(dev, ops, count);
+  if(status)
+    return status;
+  /* the modem has the values now, bring the register cache and the snapshot along */
+  regcache_cache_only(dev->regmap, true);
+  for(i = 0; i < count; i++)
+  {
+    regmap_write(dev->regmap, GALEOS_PAGED_REG(ops[i].page, ops[i].reg), ops[i].value);
+    clear_bit(GALEOS_PAGED_REG(ops[i].page, ops[i].reg), dev->wb_dirty);
+    galeos_snapshot_track(dev, GALEOS_PAGED_REG(ops[i].page, ops[i].reg), ops[i].value);
+  }
+  regcache_cache_only(dev->regmap, false);
+  return 0;
+}
+
+static int galeos_wb_flush( galeosdev_data_t *dev )
+{
+  struct galeos_reg_op ops[GALEOS_WB_BATCH];
+  unsigned page, reg, i, n = 0;
+  int status = 0;
+
+  if(bitmap_empty(dev->wb_dirty, GALEOS_MAX_REGISTER + 1))
+    return 0;
+  for(page = 0; page < GALEOS_PAGES && status == 0; page++)
+  {
+    /* i == GALEOS_PAGE_LEN stands for the mode register */
+    for(i = 0; i <= GALEOS_PAGE_LEN && status == 0; i++)
+    {
+      reg = i < GALEOS_PAGE_LEN ? i : GALEOS_REG_MODE;
+      if(i == GALEOS_REG_MODE || !test_bit(GALEOS_PAGED_REG(page, reg), dev->wb_dirty))
+        continue;
+      ops[n].page = page;
+      ops[n].reg = reg;
+      ops[n].value = dev->wb_val[GALEOS_PAGED_REG(page, reg)];
+      ops[n].op = GALEOS_OP_WRITE;
+      if(++n == GALEOS_WB_BATCH)
+      {
+        status = galeos_wb_send(dev, ops, n);
+        n = 0;
+      }
+    }
+  }
+  if(status == 0 && n)
+    status = galeos_wb_send(dev, ops, n);
+  if(status)
+    dev_err(dev->device, "write-back flush failed (%d)\n", status);
+  return status;
+}
+
+/*
+ * Register access for the rest of the driver. reg is a regmap address:
+ * 0x00..0x7F directly, or GALEOS_PAGED_REG(page, reg) for channel pages.
+ * The caller holds dev->spi_lock so multi-register sequences stay atomic.
+ */
+static int galeos_read( galeosdev_data_t *dev, unsigned int reg, unsigned int *val )
+{
+  int status;
+
+  if(reg <= GALEOS_MAX_REGISTER && test_bit(reg, dev->wb_dirty))
+  {
+    *val = dev->wb_val[reg];
+    return 0;
+  }
+  if(galeos_volatile_reg(NULL, reg))
+  {
+    status = galeos_wb_flush(dev);
+    if(status)
+      return status;
+  }
+  return regmap_read(dev->regmap, reg, val);
+}
+
+static int galeos_write( galeosdev_data_t *dev, unsigned int reg, unsigned int val )
+{
+  int status;
+
+  if(galeos_wb_holds(dev, reg))
+  {
+    /* the snapshot and the live page follow once the flush reached the modem */
+    dev->wb_val[reg] = val;
+    set_bit(reg, dev->wb_dirty);
+    queue_delayed_work(dev->workqueue, &dev->wb_work, msecs_to_jiffies(dev->wb_delay));
+    return 0;
+  }
+  status = regmap_write(dev->regmap, reg, val);
+  if(status == 0)
+    galeos_snapshot_track(dev, reg, val);
+  return status;
+}
+
+/*
+ * Registers as seen by userspace live on the page last written to 0x7F
+ * by the same user: through the reg/data pair (dev->page) or through the
+ * same open file of the character device (galeos_file_t.page). This is
+ * independent of the page the driver itself has selected for other
+ * accesses. Called with spi_lock held.
+ */
+static unsigned int galeos_user_reg( u8 page, u8 reg )
+{
+  if(reg < GALEOS_REG_PAGE && page < GALEOS_PAGES)
+    return GALEOS_PAGED_REG(page, reg);
+  return reg;
+}
+
+static int galeos_user_write( galeosdev_data_t *dev, u8 *page, u8 reg, u8 value )
+{
+  int status;
+  if(reg == GALEOS_REG_PAGE)
+  {
+    status = galeos_write(dev, GALEOS_REG_PAGE, value);
+    if(status == 0)
+      *page = value;
+    return status;
+  }
+  return galeos_write(dev, galeos_user_reg(*page, reg), value);
+}
+
+static int galeos_user_read( galeosdev_data_t *dev, u8 page, u8 reg, u8 *value )
+{
+  unsigned int val;
+  int status;
+  if(reg == GALEOS_REG_PAGE)
+  {
+    *value = page;
+    return 0;
+  }
+  status = galeos_read(dev, galeos_user_reg(page, reg), &val);
+  *value = val;
+  return status;
+}
+
+static int galeos_batch_check( const struct galeos_reg_op *ops, unsigned count )
+{
+  unsigned i;
+  for(i = 0; i < count; i++)
+  {
+    if(ops[i].reg > GALEOS_REG_MAX || ops[i].op > GALEOS_OP_WRITE ||
+       (ops[i].page != GALEOS_PAGE_NONE && ops[i].page >= GALEOS_PAGES))
+      return -EINVAL;
+  }
+  return 0;
+}
+
+/*
+ * References to a device held by users that drop device_list_lock before
+ * touching the modem: open files and netlink requests. They are counted
+ * in users, the structure is freed by the last put after remove, and its
+ * class device stays valid for dev_name() meanwhile. galeos_dev_get() is
+ * called with device_list_lock held.
+ */
+static void galeos_dev_get( galeosdev_data_t *dev )
+{
+  dev->users++;
+  get_device(dev->device);
+}
+
+static void galeos_dev_put( galeosdev_data_t *dev )
+{
+  int dofree;
+
+  mutex_lock(&device_list_lock);
+  put_device(dev->device);
+  dev->users--;
+  /* last user after the spi device went away? */
+  spin_lock_irq(&dev->spin_lock);
+  dofree = (dev->spi == NULL);
+  spin_unlock_irq(&dev->spin_lock);
+  if(dev->users == 0 && dofree)
+  {
+    vfree(dev->pm);
+    vfree(dev->live);
+    kfree(dev);
+  }
+  mutex_unlock(&device_list_lock);
+}
+
+/*
+ * Like galeos_lock(), but fails once remove has detached the SPI device:
+ * the regmap goes away with it. For users not stopped by remove itself,
+ * the character device, netlink and the sysfs stores that queue work.
+ */
+static int galeos_lock_present( galeosdev_data_t *dev )
+{
+  galeos_lock(dev);
+  if(READ_ONCE(dev->spi))
+    return 0;
+  galeos_unlock(dev);
+  return -ESHUTDOWN;
+}
+
+/*
+ * Run a batch of register operations as one engine request, so it goes
+ * out under one SPI bus lock unless other requests wait for the bus, see
+ * galeos_xfer_extend(). Entries without a page are on the user page.
+ * Values held by write-back mode are flushed first and the batch writes
+ * go straight to the modem; the register cache and the snapshot follow
+ * them, or forget the registers if the batch failed part way.
+ */
+static int galeos_batch_run( galeosdev_data_t *dev, u8 *page, struct galeos_reg_op *ops, unsigned count )
+{
+  struct galeos_reg_op *xops;
+  unsigned int vreg;
+  unsigned i;
+  int status;
+
+  xops = kmalloc_array(count, sizeof(*xops), GFP_KERNEL);
+  if(!xops)
+    return -ENOMEM;
+  for(i = 0; i < count; i++)
+  {
+    xops[i] = ops[i];
+    if(xops[i].page == GALEOS_PAGE_NONE && *page < GALEOS_PAGES)
+      xops[i].page = *page;
+  }
+
+  status = galeos_lock_present(dev);
+  if(status)
+    goto out_free;
+  status = galeos_wb_flush(dev);
+  if(status)
+    goto out_unlock;
+  WRITE_ONCE(dev->bulk_task, current);
+  status = galeos_xfer_sync(dev, xops, count);
+  WRITE_ONCE(dev->bulk_task, NULL);
+
+  if(status == 0)
+    regcache_cache_only(dev->regmap, true);
+  for(i = 0; i < count; i++)
+  {
+    if(xops[i].op != GALEOS_OP_WRITE || xops[i].page == GALEOS_PAGE_NONE)
+      continue;
+    vreg = GALEOS_PAGED_REG(xops[i].page, xops[i].reg);
+    if(galeos_volatile_reg(NULL, vreg))
+      continue;
+    if(status)
+    {
+      regcache_drop_region(dev->regmap, vreg, vreg);
+      continue;
+    }
+    regmap_write(dev->regmap, vreg, xops[i].value);
+    galeos_snapshot_track(dev, vreg, xops[i].value);
+  }
+  if(status == 0)
+  {
+    regcache_cache_only(dev->regmap, false);
+    for(i = 0; i < count; i++)
+      ops[i].value = xops[i].value;
+  }
+out_unlock:
+  galeos_unlock(dev);
+out_free:
+  kfree(xops);
+  return status;
+}
+
+/*
+ * Register profile of the device, see struct galeos_profile_header.
+ * The firmware loader calls back from its own work item, so probe does
+ * not wait for userspace or the filesystem.
+ */
+static int galeos_profile_apply( galeosdev_data_t *dev, const struct firmware *fw )
+{
+  const struct galeos_profile_header *hdr = (const void *)fw->data;
+  const struct galeos_profile_entry *entry;
+  struct galeos_reg_op *ops;
+  unsigned i, count;
+  int status;
+
+  if(fw->size < sizeof(*hdr) || memcmp(hdr->magic, GALEOS_PROFILE_MAGIC, 4) ||
+     le16_to_cpu(hdr->version) != GALEOS_PROFILE_VERSION)
+    return -EINVAL;
+  count = le16_to_cpu(hdr->count);
+  if(count == 0)
+    return 0;
+  if(count > GALEOS_BATCH_MAX || fw->size != sizeof(*hdr) + count * sizeof(*entry))
+    return -EINVAL;
+  ops = kmalloc_array(count, sizeof(*ops), GFP_KERNEL);
+  if(!ops)
+    return -ENOMEM;
+  entry = (const void *)(hdr + 1);
+  for(i = 0; i < count; i++)
+  {
+    ops[i].page = entry[i].page;
+    ops[i].reg = entry[i].reg;
+    ops[i].value = entry[i].value;
+    ops[i].op = GALEOS_OP_WRITE;
+  }
+  status = galeos_batch_check(ops, count);
+  if(status == 0)
+    status = galeos_batch_run(dev, &dev->page, ops, count);
+  kfree(ops);
+  return status ? status : count;
+}
+
+static void galeos_profile_loaded( const struct firmware *fw, void *context )
+{
+  galeosdev_data_t *dev = context;
+  int status;
+
+  if(!fw)
+  {
+    dev_dbg(dev->device, "no register profile\n");
+  }
+  else if(READ_ONCE(dev->spi))
+  {
+    status = galeos_profile_apply(dev, fw);
+    if(status < 0)
+      dev_err(dev->device, "register profile rejected: %d\n", status);
+    else
+      dev_info(dev->device, "register profile applied, %d registers\n", status);
+  }
+  release_firmware(fw);
+  if(atomic_dec_and_test(&dev->fw_pending))
+    wake_up_all(&dev->xfer_idle);
+}
+
+static int galeos_profile_load( galeosdev_data_t *dev )
+{
+  struct spi_device *spi = READ_ONCE(dev->spi);
+  const char *model = GALEOS_DRIVER_NAME;
+  const char *compatible;
+  char name[64];
+  int status;
+
+  if(!spi)
+    return -ESHUTDOWN;
+  if(spi->dev.of_node &&
+     of_property_read_string(spi->dev.of_node, "compatible", &compatible) == 0)
+  {
+    model = strchr(compatible, ',');
+    model = model ? model + 1 : compatible;
+  }
+  snprintf(name, sizeof(name), "galeos/%s-%d.%d.bin", model, spi->master->bus_num, spi->chip_select);
+  atomic_inc(&dev->fw_pending);
+  status = request_firmware_nowait(THIS_MODULE, FW_ACTION_HOTPLUG, name, &spi->dev,
+                                   GFP_KERNEL, dev, galeos_profile_loaded);
+  if(status && atomic_dec_and_test(&dev->fw_pending))
+    wake_up_all(&dev->xfer_idle);
+  return status;
+}
+
+static ssize_t show_driver_version(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  return scnprintf(buf, PAGE_SIZE, "%d.%d\n", GALEOS_DRIVER_VERSION_MAJ, GALEOS_DRIVER_VERSION_MIN);
+}
+
+static ssize_t show_device_version(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int version;
+  int status;
+  galeos_lock(device_data);
+  status = galeos_read(device_data, GALEOS_REG_VERSION, &version);
+  galeos_unlock(device_data);
+  if(status)
+    return status;
+  return scnprintf(buf, PAGE_SIZE, "0x%02X\n", (int)(version));
+}
+
+static ssize_t show_device_type(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int type;
+  int status;
+  galeos_lock(device_data);
+  status = galeos_read(device_data, GALEOS_REG_TYPE, &type);
+  galeos_unlock(device_data);
+  if(status)
+    return status;
+  return scnprintf(buf, PAGE_SIZE, "0x%02X\n", (int)type);
+}
+
+static ssize_t show_reg(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%02X\n", device_data->reg);
+}
+
+static ssize_t store_reg(struct device *dev, struct device_attribute *attr, 
+                         const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int reg = 0;
+  sscanf(buf,"%02X",&reg);
+  device_data->reg = reg & 0x7F;
+  return strlen(buf);;
+}
+
+static ssize_t show_data(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  u8 data;
+  int status;
+  galeos_lock(device_data);
+  status = galeos_user_read(device_data, device_data->page, device_data->reg, &data);
+  galeos_unlock(device_data);
+  if(status)
+    return status;
+  return scnprintf(buf, PAGE_SIZE, "%02X\n", (int)data);
+}
+
+static ssize_t store_data(struct device *dev, struct device_attribute *attr,
+                          const char *buf, size_t count)
+{
+  unsigned int data;
+  int status;
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  sscanf(buf,"%02X",&data);
+  galeos_lock(device_data);
+  status = galeos_user_write(device_data, &device_data->page, device_data->reg, (u8)(data&0xFF));
+  galeos_unlock(device_data);
+  if(status)
+    return status;
+  return strlen(buf);;
+}
+
+static DEVICE_ATTR(driver_version, S_IRUGO, show_driver_version, 0);
+static DEVICE_ATTR(device_version, S_IRUGO, show_device_version, 0);
+static DEVICE_ATTR(device_type, S_IRUGO, show_device_type, 0);
+static DEVICE_ATTR(reg, S_IRUGO | S_IWUSR, show_reg, store_reg);
+static DEVICE_ATTR(data, S_IRUGO | S_IWUSR, show_data, store_data);
+
+/*
+ * Bulk register access in the regmap address space: the direct area
+ * 0x00..0x7F (window registers on the user page, see galeos_user_reg()) or the
+ * channel pages from GALEOS_PAGED_BASE. The range must not leave its area.
+ * Accesses are split into runs within one page, so each touched page costs
+ * at most one page switch. With the register cache regmap_bulk_read() reads
+ * register by register: cached ones come from the cache, every volatile one
+ * is an engine request of its own. The page register at 0x7F of a channel page
+ * reads back as the page number and is skipped on writes; in the direct
+ * area it is the user page, as for the reg/data attributes.
+ */
+static int galeos_regmap_access( galeosdev_data_t *dev, u8 *page, u8 *buf,
+                                 unsigned int addr, size_t count, bool write )
+{
+  unsigned int reg, vreg, n, i;
+  bool direct;
+  int status;
+
+  status = galeos_lock_present(dev);
+  if(status)
+    return status;
+  /* raw accesses see the modem, not values held by write-back mode */
+  status = galeos_wb_flush(dev);
+  WRITE_ONCE(dev->bulk_task, current);
+  while(count && status == 0)
+  {
+    direct = addr < GALEOS_PAGED_BASE;
+    reg = direct ? addr : GALEOS_PAGED_OFFSET(addr);
+    if(reg == GALEOS_REG_PAGE)
+    {
+      if(direct)
+        status = write ? galeos_user_write(dev, page, reg, *buf) : galeos_user_read(dev, *page, reg, buf);
+      else if(!write)
+        *buf = GALEOS_PAGED_PAGE(addr);
+      n = 1;
+    }
+    else
+    {
+      n = min_t(size_t, count, GALEOS_REG_PAGE - reg);
+      vreg = direct ? galeos_user_reg(*page, reg) : addr;
+      if(write)
+      {
+        status = regmap_bulk_write(dev->regmap, vreg, buf, n);
+        for(i = 0; status == 0 && i < n; i++)
+          galeos_snapshot_track(dev, vreg + i, buf[i]);
+      }
+      else
+        status = regmap_bulk_read(dev->regmap, vreg, buf, n);
+    }
+    buf += n;
+    addr += n;
+    count -= n;
+  }
+  WRITE_ONCE(dev->bulk_task, NULL);
+  galeos_unlock(dev);
+  return status;
+}
+
+/* Binary register map of the channel pages, offset page * GALEOS_PAGE_LEN + reg */
+#define GALEOS_REGMAP_SIZE (GALEOS_PAGES * GALEOS_PAGE_LEN)
+
+static ssize_t read_regmap(struct file *filp, struct kobject *kobj,
+                           struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(container_of(kobj, struct device, kobj));
+  int status;
+
+  if(off >= GALEOS_REGMAP_SIZE)
+    return 0;
+  count = min_t(size_t, count, GALEOS_REGMAP_SIZE - off);
+  status = galeos_regmap_access(device_data, &device_data->page, (u8 *)buf, GALEOS_PAGED_BASE + off, count, false);
+  return status ? status : count;
+}
+
+static ssize_t write_regmap(struct file *filp, struct kobject *kobj,
+                            struct bin_attribute *attr, char *buf, loff_t off, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(container_of(kobj, struct device, kobj));
+  int status;
+
+  if(off >= GALEOS_REGMAP_SIZE)
+    return -EFBIG;
+  count = min_t(size_t, count, GALEOS_REGMAP_SIZE - off);
+  status = galeos_regmap_access(device_data, &device_data->page, (u8 *)buf, GALEOS_PAGED_BASE + off, count, true);
+  return status ? status : count;
+}
+
+static BIN_ATTR(regmap, S_IRUSR | S_IWUSR, read_regmap, write_regmap, GALEOS_REGMAP_SIZE);
+
+static struct bin_attribute *dev_bin_attrs[] = {
+  &bin_attr_regmap,
+  NULL,
+};
+
+static void galeos_status_update( galeosdev_data_t *dev, u8 pending, const u8 *status );
+static void galeos_genl_notify( galeosdev_data_t *dev, unsigned long changed );
+
+/* Registers of every channel captured by one poll, in galeos_chan_snap_t order */
+static const u8 galeos_poll_regs[] = {
+  GALEOS_REG_MODE, GALEOS_REG_SPEED_HI, GALEOS_REG_SPEED_LO, GALEOS_REG_PAM, GALEOS_REG_STATUS,
+};
+
+/* Snapshot all channels in a single engine request */
+static int galeos_poll_once( galeosdev_data_t *dev )
+{
+  struct galeos_reg_op ops[GALEOS_CHANNELS * ARRAY_SIZE(galeos_poll_regs)];
+  u8 status[GALEOS_CHANNELS];
+  struct galeos_reg_op *op;
+  unsigned long flags;
+  unsigned ch, i;
+  int ret;
+
+  op = ops;
+  for(ch = 0; ch < GALEOS_CHANNELS; ch++)
+  {
+    for(i = 0; i < ARRAY_SIZE(galeos_poll_regs); i++, op++)
+    {
+      op->page = ch;
+      op->reg = galeos_poll_regs[i];
+      op->value = 0;
+      op->op = GALEOS_OP_READ;
+    }
+  }
+  ret = galeos_xfer_sync(dev, ops, ARRAY_SIZE(ops));
+  if(ret)
+    return ret;
+
+  op = ops;
+  write_seqlock(&dev->snap_lock);
+  for(ch = 0; ch < GALEOS_CHANNELS; ch++, op += ARRAY_SIZE(galeos_poll_regs))
+  {
+    dev->snap.chan[ch].mode = op[0].value;
+    dev->snap.chan[ch].speed_hi = op[1].value;
+    dev->snap.chan[ch].speed_lo = op[2].value;
+    dev->snap.chan[ch].pam = op[3].value;
+    dev->snap.chan[ch].status = op[4].value;
+    status[ch] = op[4].value;
+  }
+  dev->snap.stamp = ktime_get();
+  dev->snap.valid = true;
+  write_sequnlock(&dev->snap_lock);
+
+  if(dev->live)
+  {
+    op = ops;
+    galeos_live_begin(dev, &flags);
+    for(ch = 0; ch < GALEOS_CHANNELS; ch++, op += ARRAY_SIZE(galeos_poll_regs))
+    {
+      /* status is left to galeos_status_update() */
+      for(i = 0; i < ARRAY_SIZE(galeos_poll_regs) - 1; i++)
+        galeos_live_config(&dev->live->chan[ch], galeos_poll_regs[i], op[i].value);
+    }
+    galeos_live_end(dev, flags);
+  }
+
+  galeos_status_update(dev, 0, status);
+  return 0;
+}
+
+static void galeos_poll_work(struct work_struct *work)
+{
+  galeosdev_data_t *dev = container_of(to_delayed_work(work), galeosdev_data_t, poll_work);
+  unsigned interval;
+
+  /* remove has detached the device, whatever the interval says */
+  if(galeos_poll_once(dev) == -ESHUTDOWN)
+    return;
+  interval = READ_ONCE(dev->poll_interval);
+  if(interval)
+    queue_delayed_work(dev->workqueue, &dev->poll_work, msecs_to_jiffies(interval));
+}
+
+static ssize_t show_poll_interval(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(device_data->poll_interval));
+}
+
+static ssize_t store_poll_interval(struct device *dev, struct device_attribute *attr,
+                                   const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int interval;
+  int status;
+
+  status = kstrtouint(buf, 0, &interval);
+  if(status)
+    return status;
+  /* remove stops polling after its spi_lock barrier, don't restart it behind it */
+  status = galeos_lock_present(device_data);
+  if(status)
+    return status;
+  cancel_delayed_work_sync(&device_data->poll_work);
+  write_seqlock(&device_data->snap_lock);
+  device_data->snap.valid = false;
+  write_sequnlock(&device_data->snap_lock);
+  WRITE_ONCE(device_data->poll_interval, interval);
+  if(interval)
+    queue_delayed_work(device_data->workqueue, &device_data->poll_work, 0);
+  galeos_unlock(device_data);
+  return count;
+}
+
+static ssize_t show_cache_age(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  galeos_snapshot_t snap;
+
+  if(!galeos_snapshot_get(device_data, &snap))
+    return scnprintf(buf, PAGE_SIZE, "-1\n");
+  return scnprintf(buf, PAGE_SIZE, "%lld\n", ktime_ms_delta(ktime_get(), snap.stamp));
+}
+
+static ssize_t store_refresh(struct device *dev, struct device_attribute *attr,
+                             const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  int status;
+
+  status = galeos_lock_present(device_data);
+  if(status)
+    return status;
+  status = galeos_poll_once(device_data);
+  galeos_unlock(device_data);
+  return status ? status : count;
+}
+
+static ssize_t store_reload_profile(struct device *dev, struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  int status = galeos_profile_load(device_data);
+  return status ? status : count;
+}
+
+static void galeos_wb_work(struct work_struct *work)
+{
+  galeosdev_data_t *dev = container_of(to_delayed_work(work), galeosdev_data_t, wb_work);
+
+  galeos_lock(dev);
+  galeos_wb_flush(dev);
+  galeos_unlock(dev);
+}
+
+static ssize_t show_write_back(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(device_data->wb_delay));
+}
+
+/* Flush delay in ms for write-back mode, 0 flushes and returns to write-through */
+static ssize_t store_write_back(struct device *dev, struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int delay;
+  int status;
+
+  status = kstrtouint(buf, 0, &delay);
+  if(status)
+    return status;
+  /* remove set wb_delay to 0 and cancelled wb_work, keep it that way */
+  status = galeos_lock_present(device_data);
+  if(status)
+    return status;
+  if(delay == 0)
+    status = galeos_wb_flush(device_data);
+  if(status == 0)
+    device_data->wb_delay = delay;
+  galeos_unlock(device_data);
+  return status ? status : count;
+}
+
+static ssize_t store_commit(struct device *dev, struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  int status;
+
+  galeos_lock(device_data);
+  status = galeos_wb_flush(device_data);
+  galeos_unlock(device_data);
+  return status ? status : count;
+}
+
+static ssize_t show_spi_speed_hz(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  return scnprintf(buf, PAGE_SIZE, "%u\n", READ_ONCE(device_data->spi_speed_hz));
+}
+
+static ssize_t store_spi_speed_hz(struct device *dev, struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  unsigned int hz;
+  int status;
+
+  status = kstrtouint(buf, 0, &hz);
+  if(status)
+    return status;
+  if(hz == 0 || (device_data->spi_max_hz && hz > device_data->spi_max_hz))
+    return -EINVAL;
+  galeos_lock(device_data);
+  WRITE_ONCE(device_data->spi_speed_hz, hz);
+  galeos_unlock(device_data);
+  return count;
+}
+
+static ssize_t show_calibration(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  ssize_t len = 0;
+  unsigned i;
+
+  galeos_lock(device_data);
+  for(i = 0; i < device_data->cal_steps; i++)
+    len += scnprintf(buf + len, PAGE_SIZE - len, "%u Hz: %u errors, %u failed transfers\n",
+                     device_data->cal_step[i].hz, device_data->cal_step[i].errors,
+                     device_data->cal_step[i].failed);
+  len += scnprintf(buf + len, PAGE_SIZE - len, "clock: %u Hz\ndownshifts: %u\n",
+                   device_data->spi_speed_hz, device_data->cal_downshifts);
+  galeos_unlock(device_data);
+  return len;
+}
+
+static DEVICE_ATTR(poll_interval, S_IRUGO | S_IWUSR, show_poll_interval, store_poll_interval);
+static DEVICE_ATTR(cache_age, S_IRUGO, show_cache_age, 0);
+static DEVICE_ATTR(refresh, S_IWUSR, 0, store_refresh);
+static DEVICE_ATTR(reload_profile, S_IWUSR, 0, store_reload_profile);
+static DEVICE_ATTR(write_back, S_IRUGO | S_IWUSR, show_write_back, store_write_back);
+static DEVICE_ATTR(commit, S_IWUSR, 0, store_commit);
+static DEVICE_ATTR(spi_speed_hz, S_IRUGO | S_IWUSR, show_spi_speed_hz, store_spi_speed_hz);
+static DEVICE_ATTR(calibration, S_IRUGO, show_calibration, 0);
+
+static struct attribute *dev_attrs[] = {
+  /* current configuration's attributes */
+  &dev_attr_driver_version.attr,
+  &dev_attr_device_version.attr,
+  &dev_attr_device_type.attr,
+  &dev_attr_reg.attr,
+  &dev_attr_data.attr,
+  &dev_attr_poll_interval.attr,
+  &dev_attr_cache_age.attr,
+  &dev_attr_refresh.attr,
+  &dev_attr_reload_profile.attr,
+  &dev_attr_write_back.attr,
+  &dev_attr_commit.attr,
+  &dev_attr_spi_speed_hz.attr,
+  &dev_attr_calibration.attr,
+  NULL,
+};
+
+
+/*
+ * Performance monitoring, off unless pm_collect is set. Once per second
+ * the status and CRC anomaly counter of every channel are read in one
+ * request and the second is classified into the current 15-minute and
+ * 24-hour bins of the ring userspace maps from the character device.
+ * Unavailability starts after GALEOS_PM_UAS_RUN severely errored seconds
+ * in a row and ends after as many seconds without; seconds are booked in
+ * the state in force. The CRC counter clears on read, so raw reads of
+ * 0x41 (register map dumps, pread(), batches) take anomalies away from
+ * the history while it is collected.
+ */
+static struct galeos_pm_bin *galeos_pm_bin( struct galeos_pm_bin *bins, u32 *cur, unsigned n,
+                                            time64_t now, u32 len )
+{
+  struct galeos_pm_bin *bin = &bins[*cur];
+  u64 start = now;
+
+  start = now - do_div(start, len);
+  if(bin->start != start)
+  {
+    if(bin->start)
+      *cur = (*cur + 1) % n;
+    bin = &bins[*cur];
+    memset(bin, 0, sizeof(*bin));
+    bin->start = start;
+  }
+  return bin;
+}
+
+static void galeos_pm_second( galeosdev_data_t *dev, unsigned channel, u8 status, u8 crc,
+                              struct galeos_pm_bin **bins, unsigned nbins )
+{
+  bool defect = status & (GALEOS_STATUS_LOSW | GALEOS_STATUS_LOS);
+  bool es = defect || crc;
+  bool ses = defect || crc >= GALEOS_PM_SES_CRC;
+  unsigned i;
+
+  if(ses != dev->pm_unavailable[channel])
+    dev->pm_ses_run[channel]++;
+  else
+    dev->pm_ses_run[channel] = 0;
+  if(dev->pm_ses_run[channel] >= GALEOS_PM_UAS_RUN)
+  {
+    dev->pm_unavailable[channel] = !dev->pm_unavailable[channel];
+    dev->pm_ses_run[channel] = 0;
+  }
+  for(i = 0; i < nbins; i++)
+  {
+    struct galeos_pm_counters *c = &bins[i]->chan[channel];
+    if(dev->pm_unavailable[channel])
+    {
+      c->uas++;
+      continue;
+    }
+    c->crc += crc;
+    c->es += es;
+    c->ses += ses;
+  }
+}
+
+static void galeos_pm_work(struct work_struct *work)
+{
+  galeosdev_data_t *dev = container_of(to_delayed_work(work), galeosdev_data_t, pm_work);
+  struct galeos_reg_op ops[2 * GALEOS_CHANNELS];
+  struct galeos_pm_ring *ring = dev->pm;
+  struct galeos_pm_bin *bins[2];
+  time64_t now;
+  unsigned i;
+
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+  {
+    ops[2 * i].page = i;
+    ops[2 * i].reg = GALEOS_REG_STATUS;
+    ops[2 * i].op = GALEOS_OP_READ;
+    ops[2 * i + 1].page = i;
+    ops[2 * i + 1].reg = GALEOS_REG_CRC;
+    ops[2 * i + 1].op = GALEOS_OP_READ;
+  }
+  if(galeos_xfer_sync(dev, ops, ARRAY_SIZE(ops)) == 0)
+  {
+    now = ktime_get_real_seconds();
+    WRITE_ONCE(ring->seq, ring->seq + 1);
+    smp_wmb();
+    bins[0] = galeos_pm_bin(ring->bins_15min, &ring->cur_15min, GALEOS_PM_15MIN, now, GALEOS_PM_15MIN_SEC);
+    bins[1] = galeos_pm_bin(ring->bins_24h, &ring->cur_24h, GALEOS_PM_24H, now, GALEOS_PM_24H_SEC);
+    for(i = 0; i < GALEOS_CHANNELS; i++)
+      galeos_pm_second(dev, i, ops[2 * i].value, ops[2 * i + 1].value, bins, ARRAY_SIZE(bins));
+    bins[0]->elapsed++;
+    bins[1]->elapsed++;
+    smp_wmb();
+    WRITE_ONCE(ring->seq, ring->seq + 1);
+  }
+  queue_delayed_work(dev->workqueue, &dev->pm_work, HZ);
+}
+
+/* Mode register value for "COT", "RTA" or "off", -EINVAL for anything else */
+static int galeos_mode_parse( const char *buf )
+{
+  if(sysfs_streq(buf, "COT") || sysfs_streq(buf, "cot"))
+    return 0x00;
+  if(sysfs_streq(buf, "RTA") || sysfs_streq(buf, "rta"))
+    return 0x01;
+  if(sysfs_streq(buf, "off"))
+    return 0xFF;
+  return -EINVAL;
+}
+
+static const char * const galeos_state_attr_names[GALEOS_CHANNELS] = {
+  "state0", "state1", "state2", "state3",
+};
+
+/*
+ * Record a new status snapshot. Channels flagged in pending or whose
+ * status differs are reported to sysfs and poll() waiters.
+ */
+static void galeos_status_update( galeosdev_data_t *dev, u8 pending, const u8 *status )
+{
+  unsigned long changed = 0, flags;
+  unsigned i;
+
+  spin_lock_irq(&dev->spin_lock);
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+  {
+    if(status[i] != dev->status[i] || (pending & BIT(i)))
+    {
+      dev->status[i] = status[i];
+      dev->chan_seq[i]++;
+      changed |= BIT(i);
+    }
+  }
+  if(changed)
+    dev->event_seq++;
+  if(changed && dev->live)
+  {
+    galeos_live_begin(dev, &flags);
+    for_each_set_bit(i, &changed, GALEOS_CHANNELS)
+    {
+      dev->live->chan[i].link = !!(status[i] & GALEOS_STATUS_LINK);
+      dev->live->chan[i].alarms = status[i] & ~GALEOS_STATUS_LINK;
+      dev->live->chan[i].seq++;
+    }
+    galeos_live_end(dev, flags);
+  }
+  spin_unlock_irq(&dev->spin_lock);
+
+  if(!changed)
+    return;
+  wake_up_interruptible(&dev->event_wait);
+  for_each_set_bit(i, &changed, GALEOS_CHANNELS)
+    sysfs_notify(&dev->device->kobj, "DSL", galeos_state_attr_names[i]);
+  galeos_genl_notify(dev, changed);
+}
+
+/* Read the interrupt summary and the status of every channel in one request */
+static int galeos_status_refresh( galeosdev_data_t *dev )
+{
+  struct galeos_reg_op ops[1 + GALEOS_CHANNELS];
+  u8 status[GALEOS_CHANNELS];
+  unsigned i;
+  int ret;
+
+  ops[0].page = GALEOS_PAGE_NONE;
+  ops[0].reg = GALEOS_REG_IRQ;
+  ops[0].op = GALEOS_OP_READ;
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+  {
+    ops[1 + i].page = i;
+    ops[1 + i].reg = GALEOS_REG_STATUS;
+    ops[1 + i].op = GALEOS_OP_READ;
+  }
+  ret = galeos_xfer_sync(dev, ops, ARRAY_SIZE(ops));
+  if(ret)
+    return ret;
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+    status[i] = ops[1 + i].value;
+  galeos_status_update(dev, ops[0].value, status);
+  return 0;
+}
+
+static irqreturn_t galeos_irq_thread(int irq, void *data)
+{
+  galeosdev_data_t *dev = data;
+  int status = galeos_status_refresh(dev);
+  /* the line is ours even if the modem could not be read, don't report it as spurious */
+  if(status)
+    dev_warn_ratelimited(dev->device, "interrupt status read failed: %d\n", status);
+  return IRQ_HANDLED;
+}
+
+static ssize_t galeos_state_show( galeosdev_data_t *device_data, unsigned channel, char *buf )
+{
+  static const char * const alarms[] = { "LOSW", "LOS", "SNRM", "LATN" };
+  unsigned int data, i;
+  galeos_snapshot_t snap;
+  int status = 0;
+  ssize_t len;
+  if(device_data->irq || galeos_snapshot_get(device_data, &snap))
+  {
+    /* kept up to date by the interrupt handler or the poller */
+    data = READ_ONCE(device_data->status[channel]);
+  }
+  else
+  {
+    galeos_lock(device_data);
+    status = galeos_read(device_data, GALEOS_PAGED_REG(channel, GALEOS_REG_STATUS), &data);
+    galeos_unlock(device_data);
+  }
+  if(status)
+    return status;
+  len = scnprintf(buf, PAGE_SIZE, "%s", (data & GALEOS_STATUS_LINK) ? "up" : "down");
+  for(i = 0; i < ARRAY_SIZE(alarms); i++)
+  {
+    if(data & (GALEOS_STATUS_LOSW << i))
+      len += scnprintf(buf + len, PAGE_SIZE - len, " %s", alarms[i]);
+  }
+  len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+  return len;
+}
+
+/*
+ * Channel configuration as one transaction: "speed=2304 mode=COT pam=16
+ * [verify]". Omitted parameters are left unchanged. Everything is checked
+ * before the first register is written, then applied under one spi_lock
+ * hold (one page switch), mode last so the line retrains only once.
+ */
+static int galeos_config_parse( const char *buf, galeos_chan_config_t *cfg )
+{
+  char *str, *cur, *tok, *val;
+  unsigned int n;
+  int status = 0;
+
+  cfg->speed = -1;
+  cfg->mode = -1;
+  cfg->pam = -1;
+  cfg->verify = false;
+
+  str = kstrdup(buf, GFP_KERNEL);
+  if(!str)
+    return -ENOMEM;
+  cur = str;
+  while(status == 0 && (tok = strsep(&cur, " \t\n")) != NULL)
+  {
+    if(*tok == '\0')
+      continue;
+    if(strcmp(tok, "verify") == 0)
+    {
+      cfg->verify = true;
+      continue;
+    }
+    val = strchr(tok, '=');
+    if(!val)
+    {
+      status = -EINVAL;
+      break;
+    }
+    *val++ = '\0';
+    if(strcmp(tok, "speed") == 0)
+    {
+      /* 64 kbit/s steps in 0x02, 8 kbit/s steps in 0x03 */
+      if(kstrtouint(val, 10, &n) || n % 8 || n / 64 > 0xFF)
+        status = -EINVAL;
+      else
+        cfg->speed = n;
+    }
+    else if(strcmp(tok, "mode") == 0)
+    {
+      cfg->mode = galeos_mode_parse(val);
+      if(cfg->mode < 0)
+        status = cfg->mode;
+    }
+    else if(strcmp(tok, "pam") == 0)
+    {
+      if(strcasecmp(val, "auto") == 0)
+        cfg->pam = 0;
+      else if(kstrtouint(val, 10, &n) || n < 4 || n > 128 || !is_power_of_2(n))
+        status = -EINVAL;
+      else
+        cfg->pam = n;
+    }
+    else
+      status = -EINVAL;
+  }
+  kfree(str);
+  return status;
+}
+
+static int galeos_config_apply( galeosdev_data_t *dev, unsigned channel, const galeos_chan_config_t *cfg )
+{
+  struct galeos_reg_op ops[4];
+  u8 regs[4], vals[4];
+  unsigned i, n = 0;
+  int status = 0;
+
+  if(cfg->speed >= 0)
+  {
+    regs[n] = GALEOS_REG_SPEED_HI; vals[n++] = cfg->speed / 64;
+    regs[n] = GALEOS_REG_SPEED_LO; vals[n++] = (cfg->speed % 64) / 8;
+  }
+  if(cfg->pam >= 0)
+  {
+    regs[n] = GALEOS_REG_PAM; vals[n++] = cfg->pam;
+  }
+  if(cfg->mode >= 0)
+  {
+    regs[n] = GALEOS_REG_MODE; vals[n++] = cfg->mode;
+  }
+
+  status = galeos_lock_present(dev);
+  if(status)
+    return status;
+  for(i = 0; i < n && status == 0; i++)
+    status = galeos_write(dev, GALEOS_PAGED_REG(channel, regs[i]), vals[i]);
+  if(status == 0 && cfg->verify)
+    status = galeos_wb_flush(dev);
+  if(status == 0 && cfg->verify)
+  {
+    /*
+     * read back from the modem in one engine request, the register cache
+     * stays in use for everybody else; the engine restores the page
+     */
+    for(i = 0; i < n; i++)
+    {
+      ops[i].page = channel;
+      ops[i].reg = regs[i];
+      ops[i].value = 0;
+      ops[i].op = GALEOS_OP_READ;
+    }
+    status = galeos_xfer_sync(dev, ops, n);
+    for(i = 0; i < n && status == 0; i++)
+    {
+      if(ops[i].value != vals[i])
+      {
+        dev_warn(dev->device, "channel %u register 0x%02X reads back 0x%02X, expected 0x%02X\n",
+                 channel, regs[i], ops[i].value, vals[i]);
+        regcache_drop_region(dev->regmap, GALEOS_PAGED_REG(channel, regs[i]), GALEOS_PAGED_REG(channel, regs[i]));
+        status = -EIO;
+      }
+    }
+  }
+  galeos_unlock(dev);
+  return status;
+}
+
+static ssize_t galeos_config_show( galeosdev_data_t *device_data, unsigned channel, char *buf )
+{
+  static const char * const modes[] = { "COT", "RTA" };
+  unsigned int hi = 0, lo = 0, mode = 0, pam = 0;
+  galeos_snapshot_t snap;
+  int status = 0;
+  if(galeos_snapshot_get(device_data, &snap))
+  {
+    hi = snap.chan[channel].speed_hi;
+    lo = snap.chan[channel].speed_lo;
+    mode = snap.chan[channel].mode;
+    pam = snap.chan[channel].pam;
+  }
+  else
+  {
+    galeos_lock(device_data);
+    status = galeos_read(device_data, GALEOS_PAGED_REG(channel, GALEOS_REG_SPEED_HI), &hi);
+    if(status == 0)
+      status = galeos_read(device_data, GALEOS_PAGED_REG(channel, GALEOS_REG_SPEED_LO), &lo);
+    if(status == 0)
+      status = galeos_read(device_data, GALEOS_PAGED_REG(channel, GALEOS_REG_MODE), &mode);
+    if(status == 0)
+      status = galeos_read(device_data, GALEOS_PAGED_REG(channel, GALEOS_REG_PAM), &pam);
+    galeos_unlock(device_data);
+    if(status)
+      return status;
+  }
+  if(pam == 0)
+    return scnprintf(buf, PAGE_SIZE, "speed=%u mode=%s pam=auto\n", hi * 64 + lo * 8,
+                     mode < ARRAY_SIZE(modes) ? modes[mode] : "off");
+  return scnprintf(buf, PAGE_SIZE, "speed=%u mode=%s pam=%u\n", hi * 64 + lo * 8,
+                   mode < ARRAY_SIZE(modes) ? modes[mode] : "off", pam);
+}
+
+static ssize_t galeos_config_store( galeosdev_data_t *device_data, unsigned channel,
+                                    const char *buf, size_t count )
+{
+  galeos_chan_config_t cfg;
+  int status;
+  status = galeos_config_parse(buf, &cfg);
+  if(status == 0)
+    status = galeos_config_apply(device_data, channel, &cfg);
+  if(status)
+    return status;
+  return count;
+}
+
+/*
+ * Per-channel DSL attributes, generated at module load from the
+ * parameter table: DSL/<name><channel> for every channel. Register
+ * parameters are read with one bulk access through the register cache
+ * (or from the poller snapshot) and converted by decode/encode.
+ */
+#define GALEOS_SNAP(field) (offsetof(galeos_chan_snap_t, field) + 1)
+
+static ssize_t galeos_num_decode( const galeos_chan_param_t *p, const u8 *regs, char *buf )
+{
+  unsigned bits = p->lo_bits ? p->lo_bits : 8;
+  int value = regs[0];
+  unsigned i;
+
+  if(p->sign && p->width == 1)
+    value = (s8)regs[0];
+  for(i = 1; i < p->width; i++)
+    value = (value << bits) | (regs[i] & ((1 << bits) - 1));
+  return scnprintf(buf, PAGE_SIZE, "%d\n", value * (p->scale ? p->scale : 1));
+}
+
+static int galeos_num_encode( const galeos_chan_param_t *p, const char *buf, u8 *regs )
+{
+  unsigned bits = p->lo_bits ? p->lo_bits : 8;
+  unsigned scale = p->scale ? p->scale : 1;
+  unsigned value;
+  int i;
+
+  if(kstrtouint(buf, 10, &value) || value % scale)
+    return -EINVAL;
+  value /= scale;
+  for(i = p->width - 1; i > 0; i--)
+  {
+    regs[i] = value & ((1 << bits) - 1);
+    value >>= bits;
+  }
+  if(value > 0xFF)
+    return -EINVAL;
+  regs[0] = value;
+  return 0;
+}
+
+static ssize_t galeos_mode_decode( const galeos_chan_param_t *p, const u8 *regs, char *buf )
+{
+  switch(regs[0])
+  {
+    case 0:
+      return scnprintf(buf, PAGE_SIZE, "COT\n");
+    case 1:
+      return scnprintf(buf, PAGE_SIZE, "RTA\n");
+  }
+  return scnprintf(buf, PAGE_SIZE, "off\n");
+}
+
+static int galeos_mode_encode( const galeos_chan_param_t *p, const char *buf, u8 *regs )
+{
+  int mode = galeos_mode_parse(buf);
+
+  if(mode < 0)
+    return mode;
+  regs[0] = mode;
+  return 0;
+}
+
+/* "auto" or "AUTO" as before; numbers must be a PAM level the modem has */
+static int galeos_pam_encode( const galeos_chan_param_t *p, const char *buf, u8 *regs )
+{
+  unsigned n;
+
+  if(sysfs_streq(buf, "auto") || sysfs_streq(buf, "AUTO"))
+    n = 0;
+  else if(kstrtouint(buf, 10, &n) || n < 4 || n > 128 || !is_power_of_2(n))
+    return -EINVAL;
+  regs[0] = n;
+  return 0;
+}
+
+static ssize_t galeos_link_decode( const galeos_chan_param_t *p, const u8 *regs, char *buf )
+{
+  return scnprintf(buf, PAGE_SIZE, "%s\n", (regs[0] & GALEOS_STATUS_LINK) ? "up" : "down");
+}
+
+static const galeos_chan_param_t galeos_chan_params[] = {
+  /* configuration, cached */
+  { .name = "speed", .reg = GALEOS_REG_SPEED_HI, .width = 2, .lo_bits = 3, .scale = 8,
+    .snap = GALEOS_SNAP(speed_hi), .decode = galeos_num_decode, .encode = galeos_num_encode },
+  { .name = "mode", .reg = GALEOS_REG_MODE, .width = 1,
+    .snap = GALEOS_SNAP(mode), .decode = galeos_mode_decode, .encode = galeos_mode_encode },
+  { .name = "pam", .reg = GALEOS_REG_PAM, .width = 1,
+    .snap = GALEOS_SNAP(pam), .decode = galeos_num_decode, .encode = galeos_pam_encode },
+  { .name = "state", .vol = true, .show = galeos_state_show },
+  { .name = "config", .show = galeos_config_show, .store = galeos_config_store },
+  /* line status and quality, read from the modem */
+  { .name = "link", .reg = GALEOS_REG_STATUS, .width = 1, .vol = true,
+    .snap = GALEOS_SNAP(status), .decode = galeos_link_decode },
+  { .name = "snr_margin", .reg = GALEOS_REG_SNR_MARGIN, .width = 1, .sign = true, .vol = true,
+    .decode = galeos_num_decode },
+  { .name = "loop_attenuation", .reg = GALEOS_REG_LATN, .width = 1, .vol = true,
+    .decode = galeos_num_decode },
+  { .name = "line_rate", .reg = GALEOS_REG_RATE_HI, .width = 2, .lo_bits = 3, .scale = 8, .vol = true,
+    .decode = galeos_num_decode },
+};
+
+/* Channel page offsets only covered by non-volatile parameters are cached */
+static bool galeos_chan_param_volatile( unsigned int offset )
+{
+  const galeos_chan_param_t *p;
+
+  for(p = galeos_chan_params; p < galeos_chan_params + ARRAY_SIZE(galeos_chan_params); p++)
+  {
+    if(!p->vol && offset >= p->reg && offset < p->reg + p->width)
+      return false;
+  }
+  return true;
+}
+
+static int galeos_chan_read( galeosdev_data_t *dev, const galeos_chan_param_t *p,
+                             unsigned channel, u8 *regs )
+{
+  unsigned int vreg = GALEOS_PAGED_REG(channel, p->reg), val;
+  galeos_snapshot_t snap;
+  bool held = false;
+  unsigned i;
+  int status = 0;
+
+  for(i = 0; i < p->width; i++)
+    held |= test_bit(vreg + i, dev->wb_dirty);
+  if(!held && p->snap && galeos_snapshot_get(dev, &snap))
+  {
+    memcpy(regs, (u8 *)&snap.chan[channel] + p->snap - 1, p->width);
+    return 0;
+  }
+  galeos_lock(dev);
+  if(held)
+  {
+    /* values still held by write-back mode */
+    for(i = 0; i < p->width && status == 0; i++)
+    {
+      status = galeos_read(dev, vreg + i, &val);
+      regs[i] = val;
+    }
+    galeos_unlock(dev);
+    return status;
+  }
+  if(p->vol)
+    status = galeos_wb_flush(dev);
+  if(status == 0)
+    status = regmap_bulk_read(dev->regmap, vreg, regs, p->width);
+  galeos_unlock(dev);
+  return status;
+}
+
+static ssize_t galeos_chan_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  galeos_chan_attr_t *ca = container_of(attr, galeos_chan_attr_t, attr);
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  const galeos_chan_param_t *p = ca->param;
+  u8 regs[GALEOS_PARAM_WIDTH_MAX];
+  ssize_t ret;
+
+  trace_galeos_attr_enter(dev, attr->attr.name, false, 0);
+  if(p->show)
+    ret = p->show(device_data, ca->channel, buf);
+  else
+  {
+    ret = galeos_chan_read(device_data, p, ca->channel, regs);
+    if(ret == 0)
+      ret = p->decode(p, regs, buf);
+  }
+  trace_galeos_attr_exit(dev, attr->attr.name, false, ret);
+  return ret;
+}
+
+static ssize_t galeos_chan_store(struct device *dev, struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+  galeos_chan_attr_t *ca = container_of(attr, galeos_chan_attr_t, attr);
+  galeosdev_data_t *device_data = dev_get_drvdata(dev);
+  const galeos_chan_param_t *p = ca->param;
+  u8 regs[GALEOS_PARAM_WIDTH_MAX];
+  ssize_t ret;
+  unsigned i;
+
+  trace_galeos_attr_enter(dev, attr->attr.name, true, 0);
+  if(p->store)
+    ret = p->store(device_data, ca->channel, buf, count);
+  else
+  {
+    ret = p->encode(p, buf, regs);
+    if(ret == 0)
+    {
+      galeos_lock(device_data);
+      for(i = 0; i < p->width && ret == 0; i++)
+        ret = galeos_write(device_data, GALEOS_PAGED_REG(ca->channel, p->reg + i), regs[i]);
+      galeos_unlock(device_data);
+    }
+    if(ret == 0)
+      ret = count;
+  }
+  trace_galeos_attr_exit(dev, attr->attr.name, true, ret);
+  return ret;
+}
+
+#define GALEOS_CHAN_ATTRS (ARRAY_SIZE(galeos_chan_params) * GALEOS_CHANNELS)
+
+static galeos_chan_attr_t *galeos_chan_attrs;
+static struct attribute *dev_dsl_attrs[GALEOS_CHAN_ATTRS + 1];
+
+static int galeos_chan_attrs_init( void )
+{
+  unsigned i;
+
+  galeos_chan_attrs = kcalloc(GALEOS_CHAN_ATTRS, sizeof(*galeos_chan_attrs), GFP_KERNEL);
+  if(!galeos_chan_attrs)
+    return -ENOMEM;
+  for(i = 0; i < GALEOS_CHAN_ATTRS; i++)
+  {
+    galeos_chan_attr_t *ca = &galeos_chan_attrs[i];
+    const galeos_chan_param_t *p = &galeos_chan_params[i / GALEOS_CHANNELS];
+    bool writable = p->encode || p->store;
+
+    ca->param = p;
+    ca->channel = i % GALEOS_CHANNELS;
+    snprintf(ca->name, sizeof(ca->name), "%s%u", p->name, ca->channel);
+    sysfs_attr_init(&ca->attr.attr);
+    ca->attr.attr.name = ca->name;
+    ca->attr.attr.mode = writable ? (S_IRUGO | S_IWUSR) : S_IRUGO;
+    ca->attr.show = galeos_chan_show;
+    ca->attr.store = writable ? galeos_chan_store : NULL;
+    dev_dsl_attrs[i] = &ca->attr.attr;
+  }
+  return 0;
+}
+
+static struct attribute_group dev_attr_grp = {
+  .attrs = dev_attrs,
+  .bin_attrs = dev_bin_attrs,
+};
+
+static struct attribute_group dev_dsl_attr_grp = {
+  .name  = (const char*)"DSL",
+  .attrs = dev_dsl_attrs,
+};
+
+static const struct attribute_group *dev_attr_grps[] = {
+  &dev_attr_grp,
+  &dev_dsl_attr_grp,
+  NULL
+};
+
+/*
+ * Generic netlink family, see galeos_ioctl.h. Configuration comes from
+ * the register cache, so a dump of every modem costs SPI traffic only
+ * for registers not read before; status is the one kept by the
+ * interrupt and the poller.
+ */
+static struct genl_family galeos_genl_family;
+
+static const struct nla_policy galeos_genl_policy[GALEOS_A_MAX + 1] = {
+  [GALEOS_A_DEVICE]  = { .type = NLA_NUL_STRING, .len = 32 },
+  [GALEOS_A_CHANNEL] = { .type = NLA_NESTED },
+};
+
+static const struct nla_policy galeos_genl_ch_policy[GALEOS_A_CH_MAX + 1] = {
+  [GALEOS_A_CH_INDEX]  = { .type = NLA_U8 },
+  [GALEOS_A_CH_SPEED]  = { .type = NLA_U32 },
+  [GALEOS_A_CH_MODE]   = { .type = NLA_U8 },
+  [GALEOS_A_CH_PAM]    = { .type = NLA_U8 },
+  [GALEOS_A_CH_STATUS] = { .type = NLA_U8 },
+  [GALEOS_A_CH_VERIFY] = { .type = NLA_FLAG },
+};
+
+static int galeos_genl_config( galeosdev_data_t *dev, galeos_chan_config_t *cfg )
+{
+  unsigned int hi = 0, lo = 0, mode = 0, pam = 0, ch;
+  int status;
+
+  status = galeos_lock_present(dev);
+  if(status)
+    return status;
+  for(ch = 0; ch < GALEOS_CHANNELS && status == 0; ch++)
+  {
+    status = galeos_read(dev, GALEOS_PAGED_REG(ch, GALEOS_REG_SPEED_HI), &hi);
+    if(status == 0)
+      status = galeos_read(dev, GALEOS_PAGED_REG(ch, GALEOS_REG_SPEED_LO), &lo);
+    if(status == 0)
+      status = galeos_read(dev, GALEOS_PAGED_REG(ch, GALEOS_REG_MODE), &mode);
+    if(status == 0)
+      status = galeos_read(dev, GALEOS_PAGED_REG(ch, GALEOS_REG_PAM), &pam);
+    cfg[ch].speed = hi * 64 + lo * 8;
+    cfg[ch].mode = mode;
+    cfg[ch].pam = pam;
+  }
+  galeos_unlock(dev);
+  return status;
+}
+
+/*
+ * One message for a device, channel configuration only when cfg is given.
+ * GET dumps also carry the status of the configuration read.
+ */
+static int galeos_genl_fill( struct sk_buff *skb, galeosdev_data_t *dev, u32 portid, u32 seq,
+                             int flags, u8 cmd, const galeos_chan_config_t *cfg, unsigned long channels,
+                             int status )
+{
+  struct nlattr *nest;
+  void *hdr;
+  unsigned ch;
+
+  hdr = genlmsg_put(skb, portid, seq, &galeos_genl_family, flags, cmd);
+  if(!hdr)
+    return -EMSGSIZE;
+  if(nla_put_string(skb, GALEOS_A_DEVICE, dev_name(dev->device)))
+    goto cancel;
+  if(cmd == GALEOS_CMD_GET && nla_put_s32(skb, GALEOS_A_STATUS, status))
+    goto cancel;
+  for_each_set_bit(ch, &channels, GALEOS_CHANNELS)
+  {
+    nest = nla_nest_start(skb, GALEOS_A_CHANNEL);
+    if(!nest)
+      goto cancel;
+    if(nla_put_u8(skb, GALEOS_A_CH_INDEX, ch) ||
+       nla_put_u8(skb, GALEOS_A_CH_STATUS, READ_ONCE(dev->status[ch])))
+      goto cancel;
+    if(cfg && (nla_put_u32(skb, GALEOS_A_CH_SPEED, cfg[ch].speed) ||
+               nla_put_u8(skb, GALEOS_A_CH_MODE, cfg[ch].mode) ||
+               nla_put_u8(skb, GALEOS_A_CH_PAM, cfg[ch].pam)))
+      goto cancel;
+    nla_nest_end(skb, nest);
+  }
+  genlmsg_end(skb, hdr);
+  return 0;
+
+cancel:
+  genlmsg_cancel(skb, hdr);
+  return -EMSGSIZE;
+}
+
+/*
+ * Devices looked up for netlink are referenced, device_list_lock is not
+ * held while their registers are read or written: galeos_lock() may wait
+ * for a modem still being brought up.
+ */
+static galeosdev_data_t *galeos_genl_get_nth( long idx )
+{
+  galeosdev_data_t *dev;
+
+  mutex_lock(&device_list_lock);
+  list_for_each_entry(dev, &device_list, device_entry)
+  {
+    if(idx-- == 0)
+    {
+      galeos_dev_get(dev);
+      mutex_unlock(&device_list_lock);
+      return dev;
+    }
+  }
+  mutex_unlock(&device_list_lock);
+  return NULL;
+}
+
+static galeosdev_data_t *galeos_genl_get_by_name( const struct nlattr *name )
+{
+  galeosdev_data_t *dev;
+
+  mutex_lock(&device_list_lock);
+  list_for_each_entry(dev, &device_list, device_entry)
+  {
+    if(nla_strcmp(name, dev_name(dev->device)) == 0)
+    {
+      galeos_dev_get(dev);
+      mutex_unlock(&device_list_lock);
+      return dev;
+    }
+  }
+  mutex_unlock(&device_list_lock);
+  return NULL;
+}
+
+static int galeos_genl_dump( struct sk_buff *skb, struct netlink_callback *cb )
+{
+  galeos_chan_config_t cfg[GALEOS_CHANNELS];
+  galeosdev_data_t *dev;
+  long idx;
+  int status;
+
+  for(idx = cb->args[0]; (dev = galeos_genl_get_nth(idx)) != NULL; idx++)
+  {
+    /* devices that can't be read are listed with the error instead of their configuration */
+    status = galeos_genl_config(dev, cfg);
+    status = galeos_genl_fill(skb, dev, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+                              NLM_F_MULTI, GALEOS_CMD_GET, status ? NULL : cfg,
+                              BIT(GALEOS_CHANNELS) - 1, status);
+    galeos_dev_put(dev);
+    if(status == -EMSGSIZE)
+      break;
+  }
+  cb->args[0] = idx;
+  return skb->len;
+}
+
+static int galeos_genl_channel( struct nlattr **tb, unsigned *channel, galeos_chan_config_t *cfg )
+{
+  u32 speed;
+  u8 pam;
+
+  if(!tb[GALEOS_A_CH_INDEX] || nla_get_u8(tb[GALEOS_A_CH_INDEX]) >= GALEOS_CHANNELS)
+    return -EINVAL;
+  *channel = nla_get_u8(tb[GALEOS_A_CH_INDEX]);
+  cfg->speed = -1;
+  cfg->mode = -1;
+  cfg->pam = -1;
+  cfg->verify = nla_get_flag(tb[GALEOS_A_CH_VERIFY]);
+  if(tb[GALEOS_A_CH_SPEED])
+  {
+    speed = nla_get_u32(tb[GALEOS_A_CH_SPEED]);
+    if(speed % 8 || speed / 64 > 0xFF)
+      return -EINVAL;
+    cfg->speed = speed;
+  }
+  if(tb[GALEOS_A_CH_MODE])
+  {
+    /* COT, RTA or off, as accepted by galeos_mode_parse() */
+    cfg->mode = nla_get_u8(tb[GALEOS_A_CH_MODE]);
+    if(cfg->mode != 0x00 && cfg->mode != 0x01 && cfg->mode != 0xFF)
+      return -EINVAL;
+  }
+  if(tb[GALEOS_A_CH_PAM])
+  {
+    pam = nla_get_u8(tb[GALEOS_A_CH_PAM]);
+    if(pam && (pam < 4 || pam > 128 || !is_power_of_2(pam)))
+      return -EINVAL;
+    cfg->pam = pam;
+  }
+  return 0;
+}
+
+static int galeos_genl_set( struct sk_buff *skb, struct genl_info *info )
+{
+  struct nlattr *tb[GALEOS_A_CH_MAX + 1];
+  galeos_chan_config_t cfg[GALEOS_CHANNELS];
+  unsigned channel[GALEOS_CHANNELS];
+  galeosdev_data_t *dev;
+  struct nlattr *nla;
+  unsigned count = 0, i;
+  int rem, status = 0;
+
+  if(!info->attrs[GALEOS_A_DEVICE])
+    return -EINVAL;
+  /* a bad nest rejects the request before the modem is touched */
+  nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem)
+  {
+    if(nla_type(nla) != GALEOS_A_CHANNEL)
+      continue;
+    if(count == GALEOS_CHANNELS)
+      return -E2BIG;
+    status = nla_parse_nested(tb, GALEOS_A_CH_MAX, nla, galeos_genl_ch_policy, info->extack);
+    if(status == 0)
+      status = galeos_genl_channel(tb, &channel[count], &cfg[count]);
+    if(status)
+      return status;
+    count++;
+  }
+  dev = galeos_genl_get_by_name(info->attrs[GALEOS_A_DEVICE]);
+  if(!dev)
+    return -ENODEV;
+  for(i = 0; i < count && status == 0; i++)
+    status = galeos_config_apply(dev, channel[i], &cfg[i]);
+  galeos_dev_put(dev);
+  return status;
+}
+
+/*
+ * Fleet reconfiguration. The channel configurations and device names are
+ * checked first, then the selected modems are referenced and grouped by
+ * SPI bus under device_list_lock. Every bus gets one work item on
+ * galeos_fleet_wq configuring its modems in turn, so the request takes
+ * about as long as the busiest bus; the list lock is not held meanwhile.
+ */
+static struct workqueue_struct *galeos_fleet_wq;
+
+static void galeos_fleet_work(struct work_struct *work)
+{
+  galeos_fleet_bus_t *bus = container_of(work, galeos_fleet_bus_t, work);
+  galeos_fleet_t *fleet = bus->fleet;
+  galeos_fleet_job_t *job;
+  unsigned i;
+
+  list_for_each_entry(job, &bus->jobs, entry)
+  {
+    job->status = 0;
+    for(i = 0; i < fleet->count && job->status == 0; i++)
+      job->status = galeos_config_apply(job->dev, fleet->channel[i], &fleet->cfg[i]);
+  }
+  if(atomic_dec_and_test(&fleet->pending))
+    complete(&fleet->done);
+}
+
+static bool galeos_fleet_selected( struct genl_info *info, galeosdev_data_t *dev )
+{
+  struct nlattr *nla;
+  bool any = false;
+  int rem;
+
+  nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem)
+  {
+    if(nla_type(nla) != GALEOS_A_DEVICE)
+      continue;
+    if(nla_strcmp(nla, dev_name(dev->device)) == 0)
+      return true;
+    any = true;
+  }
+  return !any;
+}
+
+/* Every device named in the request must exist, called with device_list_lock held */
+static int galeos_fleet_check_names( struct genl_info *info )
+{
+  galeosdev_data_t *dev;
+  struct nlattr *nla;
+  bool found;
+  int rem;
+
+  nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem)
+  {
+    if(nla_type(nla) != GALEOS_A_DEVICE)
+      continue;
+    found = false;
+    list_for_each_entry(dev, &device_list, device_entry)
+    {
+      if(nla_strcmp(nla, dev_name(dev->device)) == 0)
+      {
+        found = true;
+        break;
+      }
+    }
+    if(!found)
+    {
+      NL_SET_ERR_MSG_ATTR(info->extack, nla, "no such device");
+      return -ENODEV;
+    }
+  }
+  return 0;
+}
+
+/* Reply payload of one device: GALEOS_A_RESULT { RES_DEVICE, RES_STATUS } */
+static size_t galeos_fleet_result_size( galeosdev_data_t *dev )
+{
+  return nla_total_size(0) + nla_total_size(strlen(dev_name(dev->device)) + 1) +
+         nla_total_size(sizeof(s32));
+}
+
+static int galeos_genl_apply( struct sk_buff *skb, struct genl_info *info )
+{
+  struct nlattr *tb[GALEOS_A_CH_MAX + 1];
+  galeos_fleet_bus_t *buses = NULL;
+  galeos_fleet_job_t *jobs = NULL;
+  galeos_fleet_t fleet;
+  galeosdev_data_t *dev;
+  struct sk_buff *msg = NULL;
+  struct nlattr *nla, *nest;
+  unsigned ndev = 0, njobs = 0, nbuses = 0, i;
+  size_t size = 0;
+  s16 bus_num;
+  void *hdr;
+  int rem, status = 0;
+
+  fleet.count = 0;
+  nla_for_each_attr(nla, genlmsg_data(info->genlhdr), genlmsg_len(info->genlhdr), rem)
+  {
+    if(nla_type(nla) != GALEOS_A_CHANNEL)
+      continue;
+    if(fleet.count == GALEOS_CHANNELS)
+      return -E2BIG;
+    status = nla_parse_nested(tb, GALEOS_A_CH_MAX, nla, galeos_genl_ch_policy, info->extack);
+    if(status == 0)
+      status = galeos_genl_channel(tb, &fleet.channel[fleet.count], &fleet.cfg[fleet.count]);
+    if(status)
+      return status;
+    fleet.count++;
+  }
+  atomic_set(&fleet.pending, 0);
+  init_completion(&fleet.done);
+
+  mutex_lock(&device_list_lock);
+  status = galeos_fleet_check_names(info);
+  if(status)
+  {
+    mutex_unlock(&device_list_lock);
+    return status;
+  }
+  list_for_each_entry(dev, &device_list, device_entry)
+    ndev++;
+  jobs = kcalloc(ndev, sizeof(*jobs), GFP_KERNEL);
+  buses = kcalloc(ndev, sizeof(*buses), GFP_KERNEL);
+  if(ndev && (!jobs || !buses))
+  {
+    mutex_unlock(&device_list_lock);
+    status = -ENOMEM;
+    goto out;
+  }
+  list_for_each_entry(dev, &device_list, device_entry)
+  {
+    if(!galeos_fleet_selected(info, dev))
+      continue;
+    galeos_dev_get(dev);
+    jobs[njobs].dev = dev;
+    jobs[njobs].status = -ENODEV;
+    size += galeos_fleet_result_size(dev);
+    spin_lock_irq(&dev->spin_lock);
+    bus_num = dev->spi ? dev->spi->master->bus_num : -1;
+    spin_unlock_irq(&dev->spin_lock);
+    if(bus_num >= 0)
+    {
+      for(i = 0; i < nbuses && buses[i].bus_num != bus_num; i++)
+        ;
+      if(i == nbuses)
+      {
+        INIT_WORK(&buses[i].work, galeos_fleet_work);
+        INIT_LIST_HEAD(&buses[i].jobs);
+        buses[i].bus_num = bus_num;
+        buses[i].fleet = &fleet;
+        nbuses++;
+      }
+      list_add_tail(&jobs[njobs].entry, &buses[i].jobs);
+    }
+    njobs++;
+  }
+  mutex_unlock(&device_list_lock);
+
+  /* the reply carries one result per device, allocated before anything is changed */
+  msg = genlmsg_new(size, GFP_KERNEL);
+  if(!msg)
+  {
+    status = -ENOMEM;
+    goto out;
+  }
+  atomic_set(&fleet.pending, nbuses);
+  for(i = 0; i < nbuses; i++)
+    queue_work(galeos_fleet_wq, &buses[i].work);
+  if(nbuses)
+    wait_for_completion(&fleet.done);
+
+  hdr = genlmsg_put_reply(msg, info, &galeos_genl_family, 0, GALEOS_CMD_APPLY);
+  if(!hdr)
+  {
+    status = -EMSGSIZE;
+    goto out;
+  }
+  for(i = 0; i < njobs; i++)
+  {
+    nest = nla_nest_start(msg, GALEOS_A_RESULT);
+    if(!nest ||
+       nla_put_string(msg, GALEOS_A_RES_DEVICE, dev_name(jobs[i].dev->device)) ||
+       nla_put_s32(msg, GALEOS_A_RES_STATUS, jobs[i].status))
+    {
+      status = -EMSGSIZE;
+      goto out;
+    }
+    nla_nest_end(msg, nest);
+  }
+  genlmsg_end(msg, hdr);
+out:
+  for(i = 0; i < njobs; i++)
+    galeos_dev_put(jobs[i].dev);
+  kfree(buses);
+  kfree(jobs);
+  if(status)
+  {
+    nlmsg_free(msg);
+    return status;
+  }
+  return genlmsg_reply(msg, info);
+}
+
+/* Multicast the status of the changed channels */
+static void galeos_genl_notify( galeosdev_data_t *dev, unsigned long changed )
+{
+  struct sk_buff *skb;
+
+  if(!genl_has_listeners(&galeos_genl_family, &init_net, 0))
+    return;
+  skb = genlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+  if(!skb)
+    return;
+  if(galeos_genl_fill(skb, dev, 0, 0, 0, GALEOS_CMD_EVENT, NULL, changed, 0))
+  {
+    nlmsg_free(skb);
+    return;
+  }
+  genlmsg_multicast(&galeos_genl_family, skb, 0, 0, GFP_KERNEL);
+}
+
+static const struct genl_ops galeos_genl_ops[] = {
+  {
+    .cmd    = GALEOS_CMD_GET,
+    .policy = galeos_genl_policy,
+    .dumpit = galeos_genl_dump,
+  },
+  {
+    .cmd    = GALEOS_CMD_SET,
+    .policy = galeos_genl_policy,
+    .doit   = galeos_genl_set,
+    .flags  = GENL_ADMIN_PERM,
+  },
+  {
+    .cmd    = GALEOS_CMD_APPLY,
+    .policy = galeos_genl_policy,
+    .doit   = galeos_genl_apply,
+    .flags  = GENL_ADMIN_PERM,
+  },
+};
+
+static const struct genl_multicast_group galeos_genl_mcgrps[] = {
+  { .name = GALEOS_GENL_MCGRP_EVENTS },
+};
+
+static struct genl_family galeos_genl_family = {
+  .name     = GALEOS_GENL_NAME,
+  .version  = GALEOS_GENL_VERSION,
+  .maxattr  = GALEOS_A_MAX,
+  .module   = THIS_MODULE,
+  .ops      = galeos_genl_ops,
+  .n_ops    = ARRAY_SIZE(galeos_genl_ops),
+  .mcgrps   = galeos_genl_mcgrps,
+  .n_mcgrps = ARRAY_SIZE(galeos_genl_mcgrps),
+};
+
+static int galeos_batch_ioctl( galeos_file_t *gf, struct galeos_batch __user *ubatch )
+{
+  galeosdev_data_t *dev = gf->gdata;
+  struct galeos_batch batch;
+  struct galeos_reg_op *ops;
+  void __user *uops;
+  size_t size;
+  int status = 0;
+
+  if(copy_from_user(&batch, ubatch, sizeof(batch)))
+    return -EFAULT;
+  if(batch.flags || batch.count == 0 || batch.count > GALEOS_BATCH_MAX)
+    return -EINVAL;
+
+  uops = (void __user *)(uintptr_t)batch.ops;
+  size = batch.count * sizeof(*ops);
+  ops = memdup_user(uops, size);
+  if(IS_ERR(ops))
+    return PTR_ERR(ops);
+
+  status = galeos_batch_check(ops, batch.count);
+  if(status)
+    goto out;
+
+  status = galeos_batch_run(dev, &gf->page, ops, batch.count);
+
+  if(status == 0 && copy_to_user(uops, ops, size))
+    status = -EFAULT;
+out:
+  kfree(ops);
+  return status;
+}
+
+static int galeos_events_ioctl( galeos_file_t *gf, struct galeos_events __user *uevents )
+{
+  galeosdev_data_t *dev = gf->gdata;
+  struct galeos_events events;
+  unsigned i;
+
+  memset(&events, 0, sizeof(events));
+  spin_lock_irq(&dev->spin_lock);
+  events.seq = dev->event_seq;
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+  {
+    events.status[i] = dev->status[i];
+    if(gf->chan_seq[i] != dev->chan_seq[i])
+      events.changed |= BIT(i);
+    gf->chan_seq[i] = dev->chan_seq[i];
+  }
+  spin_unlock_irq(&dev->spin_lock);
+
+  if(copy_to_user(uevents, &events, sizeof(events)))
+    return -EFAULT;
+  return 0;
+}
+
+static long galeos_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+  galeos_file_t *gf = filp->private_data;
+  galeosdev_data_t *device_data = gf->gdata;
+  struct spi_device *spi;
+  long status;
+
+  if(_IOC_TYPE(cmd) != GALEOS_IOC_MAGIC)
+    return -ENOTTY;
+
+  /* guard against device removal before, or while, we issue this ioctl */
+  spin_lock_irq(&device_data->spin_lock);
+  spi = spi_dev_get(device_data->spi);
+  spin_unlock_irq(&device_data->spin_lock);
+  if(spi == NULL)
+    return -ESHUTDOWN;
+
+  switch(cmd)
+  {
+    case GALEOS_IOC_BATCH:
+      status = galeos_batch_ioctl(gf, (struct galeos_batch __user *)arg);
+      break;
+    case GALEOS_IOC_EVENTS:
+      status = galeos_events_ioctl(gf, (struct galeos_events __user *)arg);
+      break;
+    default:
+      status = -ENOTTY;
+      break;
+  }
+
+  spi_dev_put(spi);
+  return status;
+}
+
+/*
+ * read()/write() on the character device access registers, the file
+ * position is the regmap address (0x00..0x7F, or GALEOS_PAGED_REG(page, reg)
+ * for the channel pages). A call may not span both areas.
+ */
+static ssize_t galeos_rw( struct file *filp, u8 *kbuf, size_t count, loff_t *ppos, bool write )
 {
-  struct spi_device *spi = dev->spi;
-  struct spi_transfer *t = &dev->spi_transfer[0];
-  struct spi_message  *m = &dev->spi_message;
-  u8 * data = dev->spi_data;
-  data[0] = (reg & 0x7F);
+  galeos_file_t *gf = filp->private_data;
+  struct spi_device *spi;
+  loff_t pos = *ppos;
+  loff_t end;
+  int status;
 
-  mutex_lock(&dev->spi_lock);
+  if(pos < GALEOS_PAGE_LEN)
+    end = GALEOS_PAGE_LEN;
+  else if(pos >= GALEOS_PAGED_BASE && pos <= GALEOS_MAX_REGISTER)
+    end = GALEOS_MAX_REGISTER + 1;
+  else if(pos > GALEOS_MAX_REGISTER && !write)
+    return 0;
+  else
+    return -ENXIO;
+  count = min_t(loff_t, count, end - pos);
+  if(count == 0)
+    return 0;
 
-  gpio_set_value(dev->gpio_ac,0);
+  /* as in galeos_ioctl(), the device must not go away under the access */
+  spin_lock_irq(&gf->gdata->spin_lock);
+  spi = spi_dev_get(gf->gdata->spi);
+  spin_unlock_irq(&gf->gdata->spin_lock);
+  if(spi == NULL)
+    return -ESHUTDOWN;
+  status = galeos_regmap_access(gf->gdata, &gf->page, kbuf, pos, count, write);
+  spi_dev_put(spi);
+  if(status)
+    return status;
+  *ppos = pos + count;
+  return count;
+}
 
-  spi_message_init(m);
-  t->cs_change = 1;
-  t->tx_buf = &data[0];
-  t->len = 1;
-  t->speed_hz = dev->spi_speed_hz;
-  spi_message_add_tail(t, m);
-  spi_sync(spi,m);
+static ssize_t galeos_read_fop(struct file *filp, char __user *buf, size_t count, loff_t *ppos)
+{
+  u8 *kbuf;
+  ssize_t status;
 
-  gpio_set_value(dev->gpio_ac,1);
+  count = min_t(size_t, count, GALEOS_MAX_REGISTER + 1);
+  kbuf = kmalloc(count, GFP_KERNEL);
+  if(!kbuf)
+    return -ENOMEM;
+  status = galeos_rw(filp, kbuf, count, ppos, false);
+  if(status > 0 && copy_to_user(buf, kbuf, status))
+    status = -EFAULT;
+  kfree(kbuf);
+  return status;
+}
 
-  spi_message_init(m);
-  t->cs_change = 0;
-  data[0] = (value & 0xFF);
-  t->tx_buf = &data[0];
-  t->len = 1;
-  t->speed_hz = dev->spi_speed_hz;
-  spi_message_add_tail(t, m);
-  spi_sync(spi,m);
+static ssize_t galeos_write_fop(struct file *filp, const char __user *buf, size_t count, loff_t *ppos)
+{
+  u8 *kbuf;
+  ssize_t status;
 
-  mutex_unlock(&dev->spi_lock);
+  count = min_t(size_t, count, GALEOS_MAX_REGISTER + 1);
+  kbuf = memdup_user(buf, count);
+  if(IS_ERR(kbuf))
+    return PTR_ERR(kbuf);
+  status = galeos_rw(filp, kbuf, count, ppos, true);
+  kfree(kbuf);
+  return status;
 }
 
-static u8 galeos_register_read( galeosdev_data_t *dev, u8 reg)
+static loff_t galeos_llseek(struct file *filp, loff_t offset, int whence)
 {
-  struct spi_device *spi = dev->spi;
-  struct spi_transfer *t = &dev->spi_transfer[0];
-  struct spi_message  *m = &dev->spi_message;
-  u8 * data = dev->spi_data;
-  data[0] = (reg | 0x80);
+  return fixed_size_llseek(filp, offset, whence, GALEOS_MAX_REGISTER + 1);
+}
 
-  mutex_lock(&dev->spi_lock);
+static unsigned int galeos_poll(struct file *filp, poll_table *wait)
+{
+  galeos_file_t *gf = filp->private_data;
+  galeosdev_data_t *dev = gf->gdata;
+  unsigned int mask = 0;
+  unsigned i;
 
-  gpio_set_value(dev->gpio_ac,0);
+  poll_wait(filp, &dev->event_wait, wait);
+  spin_lock_irq(&dev->spin_lock);
+  for(i = 0; i < GALEOS_CHANNELS; i++)
+  {
+    if(gf->chan_seq[i] != dev->chan_seq[i])
+      mask = POLLIN | POLLRDNORM | POLLPRI;
+  }
+  spin_unlock_irq(&dev->spin_lock);
+  return mask;
+}
 
-  spi_message_init(m);
-  t->cs_change = 1;
-  t->tx_buf = &data[0];
-  t->len = 1;
-  t->speed_hz = dev->spi_speed_hz;
-  spi_message_add_tail(t, m);
-  spi_sync(spi,m);
+static int galeos_open(struct inode *inode, struct file *filp)
+{
+  galeosdev_data_t *device_data;
+  galeos_file_t *gf;
+  int status = -ENXIO;
 
-  gpio_set_value(dev->gpio_ac,1);
+  gf = kzalloc(sizeof(*gf), GFP_KERNEL);
+  if(!gf)
+    return -ENOMEM;
 
-  spi_message_init(m);
-  t->cs_change = 0;
-  t->tx_buf = &data[0];
-  t->rx_buf = &data[1];
-  t->len = 1;
-  t->speed_hz = dev->spi_speed_hz;
-  spi_message_add_tail(t, m);
-  spi_sync(spi,m);
+  mutex_lock(&device_list_lock);
+  list_for_each_entry(device_data, &device_list, device_entry) {
+    if (device_data->devt == inode->i_rdev) {
+      status = 0;
+      break;
+    }
+  }
+  if(status == 0)
+  {
+    galeos_dev_get(device_data);
+    gf->gdata = device_data;
+    /* only changes after open are reported */
+    spin_lock_irq(&device_data->spin_lock);
+    memcpy(gf->chan_seq, device_data->chan_seq, sizeof(gf->chan_seq));
+    spin_unlock_irq(&device_data->spin_lock);
+    /* the window starts on the page of the reg/data pair */
+    gf->page = READ_ONCE(device_data->page);
+    filp->private_data = gf;
+  }
+  mutex_unlock(&device_list_lock);
+  if(status)
+    kfree(gf);
+  return status;
+}
 
-  mutex_unlock(&dev->spi_lock);
+static int galeos_release(struct inode *inode, struct file *filp)
+{
+  galeos_file_t *gf = filp->private_data;
+  galeosdev_data_t *device_data = gf->gdata;
 
-  return data[1];
+  filp->private_data = NULL;
+  kfree(gf);
+  galeos_dev_put(device_data);
+  return 0;
 }
 
-static ssize_t show_driver_version(struct device *dev, struct device_attribute *attr, char *buf)
+/* Performance monitoring history, struct galeos_pm_ring at offset 0 */
+static int galeos_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-  return scnprintf(buf, PAGE_SIZE, "%d.%d\n", GALEOS_DRIVER_VERSION_MAJ, GALEOS_DRIVER_VERSION_MIN);
+  galeos_file_t *gf = filp->private_data;
+  galeosdev_data_t *dev = gf->gdata;
+  void *area;
+
+  /* PM history at offset 0, live status page at GALEOS_MMAP_LIVE */
+  if(vma->vm_pgoff == 0)
+    area = dev->pm;
+  else if(vma->vm_pgoff == GALEOS_MMAP_LIVE >> PAGE_SHIFT)
+    area = dev->live;
+  else
+    return -EINVAL;
+  if(!area)
+    return -ENODEV;
+  if(vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+  return remap_vmalloc_range(vma, area, 0);
 }
 
-static ssize_t show_device_version(struct device *dev, struct device_attribute *attr, char *buf)
+static const struct file_operations galeos_fops = {
+  .owner          = THIS_MODULE,
+  .open           = galeos_open,
+  .release        = galeos_release,
+  .poll           = galeos_poll,
+  .read           = galeos_read_fop,
+  .write          = galeos_write_fop,
+  .unlocked_ioctl = galeos_ioctl,
+  .compat_ioctl   = galeos_ioctl,
+  .llseek         = galeos_llseek,
+  .mmap           = galeos_mmap,
+};
+
+static void galeos_hist_show( struct seq_file *s, const char *name, const u64 *hist )
 {
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8 version = galeos_register_read(device_data, 0x61);
-  return scnprintf(buf, PAGE_SIZE, "0x%02X\n", (int)(version));
+  unsigned i;
+  seq_printf(s, "%s:\n", name);
+  for(i = 0; i < GALEOS_HIST_BUCKETS; i++)
+  {
+    if(hist[i] == 0)
+      continue;
+    if(i == GALEOS_HIST_BUCKETS - 1)
+      seq_printf(s, "  [%12llu,          inf) ns %llu\n", 1ULL << i, hist[i]);
+    else
+      seq_printf(s, "  [%12llu, %12llu) ns %llu\n", i ? 1ULL << i : 0, 1ULL << (i + 1), hist[i]);
+  }
 }
 
-static ssize_t show_device_type(struct device *dev, struct device_attribute *attr, char *buf)
+static int galeos_stats_show( struct seq_file *s, void *unused )
 {
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8 type = galeos_register_read(device_data, 0x60);
-  return scnprintf(buf, PAGE_SIZE, "0x%02X\n", (int)type);
+  galeosdev_data_t *dev = s->private;
+  galeos_stats_t *st = &dev->stats;
+
+  seq_printf(s, "reads: %llu\n", st->reads);
+  seq_printf(s, "writes: %llu\n", st->writes);
+  seq_printf(s, "page_switches: %llu\n", st->page_switches);
+  seq_printf(s, "requests: %llu\n", st->requests);
+  seq_printf(s, "errors: %llu\n", st->errors);
+  seq_printf(s, "lock_acquisitions: %llu\n", st->lock_acquisitions);
+  seq_printf(s, "lock_wait_ns: %llu\n", st->lock_wait_ns);
+  seq_printf(s, "rdy_waits: %llu\n", st->rdy_waits);
+  seq_printf(s, "rdy_timeouts: %llu\n", st->rdy_timeouts);
+  seq_printf(s, "spi_hz: %u\n", dev->spi_speed_hz);
+  galeos_hist_show(s, "lock_wait", st->lock_hist);
+  galeos_hist_show(s, "access_latency", st->access_hist);
+  galeos_hist_show(s, "request_latency", st->request_hist);
+  return 0;
 }
 
-static ssize_t show_reg(struct device *dev, struct device_attribute *attr, char *buf)
+static const char * const galeos_prio_names[GALEOS_PRIOS] = {
+  [GALEOS_PRIO_INTERACTIVE] = "interactive",
+  [GALEOS_PRIO_BULK]        = "bulk",
+};
+
+/* Scheduler of the SPI bus the device is on, shared with its neighbours */
+static int galeos_bus_show( struct seq_file *s, void *unused )
 {
-  return scnprintf(buf, PAGE_SIZE, "%02X\n", reg);
+  galeosdev_data_t *dev = s->private;
+  galeos_bus_t *bus = dev->bus;
+  galeos_prio_stats_t st;
+  unsigned long flags;
+  unsigned i;
+
+  seq_printf(s, "bus: %d\n", bus->master->bus_num);
+  for(i = 0; i < GALEOS_PRIOS; i++)
+  {
+    spin_lock_irqsave(&bus->lock, flags);
+    st = bus->stats[i];
+    spin_unlock_irqrestore(&bus->lock, flags);
+    seq_printf(s, "%s: depth %u max_depth %u queued %llu dispatched %llu wait_ns %llu max_wait_ns %llu\n",
+               galeos_prio_names[i], st.depth, st.max_depth, st.queued, st.dispatched,
+               st.wait_ns, st.max_wait_ns);
+  }
+  return 0;
 }
 
-static ssize_t store_reg(struct device *dev, struct device_attribute *attr, 
-                         const char *buf, size_t count)
+static int galeos_bus_open( struct inode *inode, struct file *file )
 {
-  sscanf(buf,"%02X",&reg);
-  return strlen(buf);;
+  return single_open(file, galeos_bus_show, inode->i_private);
 }
 
-static ssize_t show_data(struct device *dev, struct device_attribute *attr, char *buf)
+static const struct file_operations galeos_bus_fops = {
+  .owner   = THIS_MODULE,
+  .open    = galeos_bus_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static int galeos_stats_open( struct inode *inode, struct file *file )
 {
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8 data =  galeos_register_read(device_data, (u8)(reg&0xFF));
-  return scnprintf(buf, PAGE_SIZE, "%02X\n", (int)data);
+  return single_open(file, galeos_stats_show, inode->i_private);
 }
 
-static ssize_t store_data(struct device *dev, struct device_attribute *attr,
-                          const char *buf, size_t count)
+static const struct file_operations galeos_stats_fops = {
+  .owner   = THIS_MODULE,
+  .open    = galeos_stats_open,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+};
+
+static ssize_t galeos_stats_reset( struct file *file, const char __user *buf,
+                                   size_t count, loff_t *ppos )
 {
-  unsigned int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  sscanf(buf,"%02X",&data);
-  galeos_register_write(device_data, (u8)(reg&0xFF), (u8)(data&0xFF));
-  return strlen(buf);;
+  galeosdev_data_t *dev = file->private_data;
+  memset(&dev->stats, 0, sizeof(dev->stats));
+  return count;
 }
 
-static DEVICE_ATTR(driver_version, S_IRUGO, show_driver_version, 0);
-static DEVICE_ATTR(device_version, S_IRUGO, show_device_version, 0);
-static DEVICE_ATTR(device_type, S_IRUGO, show_device_type, 0);
-static DEVICE_ATTR(reg, S_IRUGO | S_IWUSR, show_reg, store_reg);
-static DEVICE_ATTR(data, S_IRUGO | S_IWUSR, show_data, store_data);
-
-static struct attribute *dev_attrs[] = {
-  /* current configuration's attributes */
-  &dev_attr_driver_version.attr,
-  &dev_attr_device_version.attr,
-  &dev_attr_device_type.attr,
-  &dev_attr_reg.attr,
-  &dev_attr_data.attr,
-  NULL,
+static const struct file_operations galeos_reset_fops = {
+  .owner  = THIS_MODULE,
+  .open   = simple_open,
+  .write  = galeos_stats_reset,
+  .llseek = noop_llseek,
 };
 
-
-static ssize_t show_speed(struct device *dev, struct device_attribute *attr, char *buf)
+static void galeos_debugfs_init( galeosdev_data_t *dev )
 {
-  u8  page;
-  int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "speed0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "speed1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "speed2") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x02);
-  }
-  else if(strcmp(attr->attr.name, "speed3") == 0)
+  if(IS_ERR_OR_NULL(galeos_debugfs_root))
+    return;
+  dev->debugfs = debugfs_create_dir(dev_name(dev->device), galeos_debugfs_root);
+  if(IS_ERR_OR_NULL(dev->debugfs))
   {
-    galeos_register_write(device_data, 0x7F, 0x03);
+    dev->debugfs = NULL;
+    return;
   }
-  data = galeos_register_read(device_data, (u8)(0x02)) * 64;
-  data += galeos_register_read(device_data, (u8)(0x03)) * 8;
-  galeos_register_write(device_data, 0x7F,page);
-  return scnprintf(buf, PAGE_SIZE, "%d\n", (int)data);
+  debugfs_create_file("stats", S_IRUSR, dev->debugfs, dev, &galeos_stats_fops);
+  debugfs_create_file("reset", S_IWUSR, dev->debugfs, dev, &galeos_reset_fops);
+  debugfs_create_file("bus", S_IRUSR, dev->debugfs, dev, &galeos_bus_fops);
 }
 
-static ssize_t store_speed(struct device *dev, struct device_attribute *attr,
-                          const char *buf, size_t count)
+/*
+ * SPI clock calibration. Without a configured clock the modem is brought
+ * up at 1 MHz, then the clock is raised step by step while patterns
+ * written to the scratch register and the type/version registers read
+ * back correctly. The modem then runs at GALEOS_CAL_MARGIN_PCT of the
+ * highest clock that passed, not rounded to a step. Runs before the page register is read, as
+ * a garbled access may have hit it. Called with spi_lock held.
+ */
+static const u32 galeos_cal_rates[GALEOS_CAL_STEPS] = {
+  1000000, 2000000, 4000000, 5000000, 8000000, 10000000,
+  12500000, 16000000, 20000000, 25000000, 33000000, 50000000,
+};
+
+/* One pattern set at the current clock: the number of mismatches, or a transfer error */
+static int galeos_cal_check( galeosdev_data_t *dev )
 {
-  unsigned int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8  page;
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "speed0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "speed1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "speed2") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x02);
-  }
-  else if(strcmp(attr->attr.name, "speed3") == 0)
+  static const u8 patterns[] = { 0x55, 0xAA, 0x00, 0xFF, 0x5A, 0xA5, 0x01, 0x80 };
+  struct galeos_reg_op ops[2 * ARRAY_SIZE(patterns) + 2];
+  unsigned i, n = 0;
+  int status, errors = 0;
+
+  for(i = 0; i < ARRAY_SIZE(patterns); i++)
   {
-    galeos_register_write(device_data, 0x7F, 0x03);
+    ops[n++] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_SCRATCH, patterns[i], GALEOS_OP_WRITE };
+    ops[n++] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_SCRATCH, 0, GALEOS_OP_READ };
   }
-  sscanf(buf,"%d",&data);
-  galeos_register_write(device_data, 0x02, data/64);
-  galeos_register_write(device_data, 0x03, (data%64)/8);
-
-  galeos_register_write(device_data, 0x7F,page);
-  return strlen(buf);
+  ops[n++] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_TYPE, 0, GALEOS_OP_READ };
+  ops[n++] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_VERSION, 0, GALEOS_OP_READ };
+  status = galeos_xfer_sync(dev, ops, n);
+  if(status)
+    return status;
+  for(i = 0; i < ARRAY_SIZE(patterns); i++)
+    errors += ops[2 * i + 1].value != patterns[i];
+  errors += ops[n - 2].value != dev->modem_type;
+  errors += ops[n - 1].value != dev->modem_version;
+  return errors;
 }
 
-static DEVICE_ATTR(speed0, S_IRUGO | S_IWUSR, show_speed, store_speed);
-static DEVICE_ATTR(speed1, S_IRUGO | S_IWUSR, show_speed, store_speed);
-static DEVICE_ATTR(speed2, S_IRUGO | S_IWUSR, show_speed, store_speed);
-static DEVICE_ATTR(speed3, S_IRUGO | S_IWUSR, show_speed, store_speed);
-
-static ssize_t show_mode(struct device *dev, struct device_attribute *attr, char *buf)
+static void galeos_calibrate( galeosdev_data_t *dev )
 {
-  u8  page;
-  int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "mode0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "mode1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "mode2") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x02);
-  }
-  else if(strcmp(attr->attr.name, "mode3") == 0)
+  unsigned i, r, errors, failed;
+  u32 good = 0, hz = galeos_cal_rates[0];
+  int status;
+
+  dev->cal_steps = 0;
+  for(i = 0; i < GALEOS_CAL_STEPS; i++)
   {
-    galeos_register_write(device_data, 0x7F, 0x03);
-  }
-  data = galeos_register_read(device_data, (u8)(0x01));
-  galeos_register_write(device_data, 0x7F,page);
-  switch(data){
-    case 0:
+    if(dev->spi_max_hz && galeos_cal_rates[i] > dev->spi_max_hz)
+      break;
+    WRITE_ONCE(dev->spi_speed_hz, galeos_cal_rates[i]);
+    for(r = 0, errors = 0, failed = 0; r < GALEOS_CAL_ROUNDS; r++)
     {
-      return scnprintf(buf, PAGE_SIZE, "COT\n", (int)data);
-    }break;
-    case 1:
-    {
-      return scnprintf(buf, PAGE_SIZE, "RTA\n", (int)data);
-    }break;
+      status = galeos_cal_check(dev);
+      if(status < 0)
+        failed++;
+      else
+        errors += status;
+    }
+    dev->cal_step[i].hz = galeos_cal_rates[i];
+    dev->cal_step[i].errors = min(errors, 255U);
+    dev->cal_step[i].failed = failed;
+    dev->cal_steps = i + 1;
+    if(errors || failed)
+      break;
+    good = galeos_cal_rates[i];
   }
-  return scnprintf(buf, PAGE_SIZE, "off\n", (int)data);
+  /* the margin may take the clock below the 1 MHz start, without a stable step it stays there */
+  if(good)
+    hz = mult_frac(good, GALEOS_CAL_MARGIN_PCT, 100);
+  /* the board limit may be below the lowest step */
+  if(dev->spi_max_hz && hz > dev->spi_max_hz)
+    hz = dev->spi_max_hz;
+  WRITE_ONCE(dev->spi_speed_hz, hz);
+  dev_info(dev->device, "SPI clock %u Hz, stable up to %u Hz\n", hz, good);
 }
 
-static ssize_t store_mode(struct device *dev, struct device_attribute *attr,
-                          const char *buf, size_t count)
+/*
+ * Periodic check at the current clock, one step down on mismatches. The
+ * modem is in service, so only type and version are read back: pattern
+ * writes at a failing clock could land in live registers. Transfer
+ * errors are not taken as a sign of a bad clock.
+ */
+static void galeos_cal_work( struct work_struct *work )
 {
-  unsigned int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8  page;
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "mode0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "mode1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "mode2") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x02);
-  }
-  else if(strcmp(attr->attr.name, "mode3") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x03);
-  }
-  if(strncmp(buf,"COT",3) == 0 || strncmp(buf,"cot",3) == 0)
-  {
-    galeos_register_write(device_data, 0x01, 0x00);
-  }
-  else if(strncmp(buf, "RTA",3) == 0 || strncmp(buf, "rta",3) == 0)
+  galeosdev_data_t *dev = container_of(to_delayed_work(work), galeosdev_data_t, cal_work);
+  struct galeos_reg_op ops[2 * GALEOS_CAL_ROUNDS];
+  unsigned i, errors = 0;
+  u32 hz = galeos_cal_rates[0];
+  int status;
+
+  for(i = 0; i < GALEOS_CAL_ROUNDS; i++)
   {
-    galeos_register_write(device_data, 0x01, 0x01);
+    ops[2 * i] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_TYPE, 0, GALEOS_OP_READ };
+    ops[2 * i + 1] = (struct galeos_reg_op){ GALEOS_PAGE_NONE, GALEOS_REG_VERSION, 0, GALEOS_OP_READ };
   }
-  else
+  galeos_lock(dev);
+  status = galeos_xfer_sync(dev, ops, ARRAY_SIZE(ops));
+  for(i = 0; status == 0 && i < GALEOS_CAL_ROUNDS; i++)
+    errors += (ops[2 * i].value != dev->modem_type) + (ops[2 * i + 1].value != dev->modem_version);
+  if(status)
+    dev_dbg(dev->device, "SPI clock re-check failed: %d\n", status);
+  else if(errors && dev->spi_speed_hz > hz)
   {
-    galeos_register_write(device_data, 0x01, 0xFF);
+    for(i = 0; i < GALEOS_CAL_STEPS && galeos_cal_rates[i] < dev->spi_speed_hz; i++)
+      hz = galeos_cal_rates[i];
+    dev_warn(dev->device, "%u errors at %u Hz, SPI clock lowered to %u Hz\n",
+             errors, dev->spi_speed_hz, hz);
+    WRITE_ONCE(dev->spi_speed_hz, hz);
+    dev->cal_downshifts++;
   }
-  galeos_register_write(device_data, 0x7F,page);
-  return strlen(buf);
+  galeos_unlock(dev);
+  if(spi_recheck)
+    queue_delayed_work(dev->workqueue, &dev->cal_work, spi_recheck * HZ);
 }
 
-static DEVICE_ATTR(mode0, S_IRUGO | S_IWUSR, show_mode, store_mode);
-static DEVICE_ATTR(mode1, S_IRUGO | S_IWUSR, show_mode, store_mode);
-static DEVICE_ATTR(mode2, S_IRUGO | S_IWUSR, show_mode, store_mode);
-static DEVICE_ATTR(mode3, S_IRUGO | S_IWUSR, show_mode, store_mode);
+/*
+ * Schedulers of the SPI buses with modems, looked up by controller at
+ * probe and freed with the last modem. Under device_list_lock.
+ */
+static LIST_HEAD(galeos_bus_list);
 
-static ssize_t show_pam(struct device *dev, struct device_attribute *attr, char *buf)
+static galeos_bus_t *galeos_bus_get( struct spi_master *master )
 {
-  u8  page;
-  int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "pam0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "pam1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "pam2") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x02);
-  }
-  else if(strcmp(attr->attr.name, "pam3") == 0)
+  galeos_bus_t *bus;
+  unsigned i;
+
+  list_for_each_entry(bus, &galeos_bus_list, entry)
   {
-    galeos_register_write(device_data, 0x7F, 0x03);
+    if(bus->master == master)
+    {
+      bus->refs++;
+      return bus;
+    }
   }
-  data = galeos_register_read(device_data, (u8)(0x0C));
-  galeos_register_write(device_data, 0x7F,page);
-  return scnprintf(buf, PAGE_SIZE, "%d\n", (int)data);
+  bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+  if(!bus)
+    return NULL;
+  bus->master = master;
+  bus->refs = 1;
+  spin_lock_init(&bus->lock);
+  for(i = 0; i < GALEOS_PRIOS; i++)
+    INIT_LIST_HEAD(&bus->queue[i]);
+  list_add(&bus->entry, &galeos_bus_list);
+  return bus;
 }
 
-static ssize_t store_pam(struct device *dev, struct device_attribute *attr,
-                          const char *buf, size_t count)
+static void galeos_bus_put( galeos_bus_t *bus )
 {
-  unsigned int data;
-  galeosdev_data_t *device_data = dev_get_drvdata(dev);
-  u8  page;
-  page = galeos_register_read(device_data, (u8)(0x7F));
-  if(strcmp(attr->attr.name, "pam0") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x00);
-  }
-  else if(strcmp(attr->attr.name, "pam1") == 0)
-  {
-    galeos_register_write(device_data, 0x7F, 0x01);
-  }
-  else if(strcmp(attr->attr.name, "pam2") == 0)
+  if(--bus->refs)
+    return;
+  list_del(&bus->entry);
+  kfree(bus);
+}
+
+/*
+ * Modem bring-up, deferred from probe so that modems come up in
+ * parallel: reset pulse, wait for gpio-rdy, identification, then the
+ * interrupt, the register profile and the poller.
+ */
+static void galeos_init_work( struct work_struct *work )
+{
+  galeosdev_data_t *dev = container_of(work, galeosdev_data_t, init_work);
+  unsigned int type = 0, version = 0, page = GALEOS_PAGE_NONE;
+  unsigned long timeout;
+  int status;
+
+  mutex_lock(&dev->spi_lock);
+  if(dev->gpio_reset)
   {
-    galeos_register_write(device_data, 0x7F, 0x02);
+    gpio_set_value(dev->gpio_reset, 0);
+    msleep(GALEOS_RESET_MS);
+    gpio_set_value(dev->gpio_reset, 1);
   }
-  else if(strcmp(attr->attr.name, "pam3") == 0)
+  if(dev->gpio_rdy)
   {
-    galeos_register_write(device_data, 0x7F, 0x03);
+    timeout = jiffies + msecs_to_jiffies(GALEOS_READY_TIMEOUT_MS);
+    while(!gpio_get_value(dev->gpio_rdy) && time_before(jiffies, timeout))
+      msleep(GALEOS_READY_POLL_MS);
+    if(!gpio_get_value(dev->gpio_rdy))
+      dev_warn(dev->device, "modem not ready after %d ms\n", GALEOS_READY_TIMEOUT_MS);
+    // Register accesses wait for the modem from here on
+    dev->rdy_irq = gpio_to_irq(dev->gpio_rdy);
+    if(dev->rdy_irq < 0 ||
+       request_irq(dev->rdy_irq, galeos_rdy_irq, IRQF_TRIGGER_RISING, "galeos-rdy", dev))
+    {
+      dev_warn(dev->device, "no gpio-rdy interrupt, transfers are not paced by the modem\n");
+      dev->rdy_irq = 0;
+    }
   }
-  if(strlen(buf)>4)
+  status = regmap_read(dev->regmap, GALEOS_REG_TYPE, &type);
+  if(status == 0)
+    status = regmap_read(dev->regmap, GALEOS_REG_VERSION, &version);
+  dev->modem_type = type;
+  dev->modem_version = version;
+  if(status == 0 && dev->spi_calibrate)
+    galeos_calibrate(dev);
+  // Page currently selected in the modem
+  if(status == 0)
+    status = regmap_read(dev->regmap, GALEOS_REG_PAGE, &page);
+  dev->page = page;
+  mutex_unlock(&dev->spi_lock);
+  if(status)
+    dev_err(dev->device, "modem identification failed: %d\n", status);
+  else
+    dev_info(dev->device, "modem type 0x%02X version 0x%02X\n", type, version);
+
+  // Channel status and link/alarm interrupt
+  galeos_status_refresh(dev);
+  // Channel configuration for the live status page
+  if(dev->live)
+    galeos_poll_once(dev);
+  if(dev->gpio_irq)
   {
-    if(strncmp(buf,"AUTO",4) == 0 || strncmp(buf,"auto",4) == 0)
+    dev->irq = gpio_to_irq(dev->gpio_irq);
+    if(request_threaded_irq(dev->irq, NULL, galeos_irq_thread,
+                            IRQF_TRIGGER_LOW | IRQF_ONESHOT,
+                            dev_name(dev->device), dev))
     {
-      galeos_register_write(device_data, 0x0C, 0x00);
-      return strlen(buf);
+      dev_warn(dev->device, "can't request irq %d, state is read on demand\n", dev->irq);
+      dev->irq = 0;
     }
   }
-  sscanf(buf,"%d",&data);
-  galeos_register_write(device_data, 0x0C, (u8)data);
-  galeos_register_write(device_data, 0x7F,page);
-  return strlen(buf);
-}
-
-static DEVICE_ATTR(pam0, S_IRUGO | S_IWUSR, show_pam, store_pam);
-static DEVICE_ATTR(pam1, S_IRUGO | S_IWUSR, show_pam, store_pam);
-static DEVICE_ATTR(pam2, S_IRUGO | S_IWUSR, show_pam, store_pam);
-static DEVICE_ATTR(pam3, S_IRUGO | S_IWUSR, show_pam, store_pam);
-
-static struct attribute *dev_dsl_attrs[] = {
-  /* current configuration's attributes */
-  &dev_attr_speed0.attr,
-  &dev_attr_speed1.attr,
-  &dev_attr_speed2.attr,
-  &dev_attr_speed3.attr,
-  &dev_attr_mode0.attr,
-  &dev_attr_mode1.attr,
-  &dev_attr_mode2.attr,
-  &dev_attr_mode3.attr,
-  &dev_attr_pam0.attr,
-  &dev_attr_pam1.attr,
-  &dev_attr_pam2.attr,
-  &dev_attr_pam3.attr,
-  NULL,
-};
-
-static struct attribute_group dev_attr_grp = {
-  .attrs = dev_attrs,
-};
-
-static struct attribute_group dev_dsl_attr_grp = {
-  .name  = (const char*)"DSL",
-  .attrs = dev_dsl_attrs,
-};
+  complete_all(&dev->init_done);
 
-static const struct attribute_group *dev_attr_grps[] = {
-  &dev_attr_grp,
-  &dev_dsl_attr_grp,
-  NULL
-};
+  // Per-device register profile, applied once userspace provides it
+  galeos_profile_load(dev);
+  if(dev->poll_interval)
+    queue_delayed_work(dev->workqueue, &dev->poll_work, 0);
+  if(dev->pm)
+    queue_delayed_work(dev->workqueue, &dev->pm_work, HZ);
+  if(spi_recheck)
+    queue_delayed_work(dev->workqueue, &dev->cal_work, spi_recheck * HZ);
+}
 
 static int galeosspidev_probe(struct spi_device *spi)
 {
   unsigned long  minor;
   galeosdev_data_t *device_data;
-  void *ptr;
+  struct galeos_platform_data *pdata;
+  const void *ptr;
   int status,number;
   // Check device is present
-  printk(KERN_EMERG "Galeos SPI Driver Probe...\n");
+  dev_dbg(&spi->dev, "probe\n");
   if (spi->dev.of_node && !of_match_device(galeos_of_match, &spi->dev)) {
     dev_err(&spi->dev, "buggy DT: device_data listed directly in DT\n");
     WARN_ON(spi->dev.of_node && !of_match_device(galeos_of_match, &spi->dev));
@@ -427,19 +3383,79 @@ static int galeosspidev_probe(struct spi_device *spi)
     return  -ENOMEM;
   // Assign spi device
   device_data->spi = spi_dev_get(spi);;
+  spin_lock_init(&device_data->spin_lock);
+  spin_lock_init(&device_data->live_lock);
+  timer_setup(&device_data->rdy_timer, galeos_rdy_timeout, 0);
+  mutex_init(&device_data->spi_lock);
+  init_waitqueue_head(&device_data->xfer_idle);
+  init_waitqueue_head(&device_data->rdy_wait);
+  init_waitqueue_head(&device_data->event_wait);
+  seqlock_init(&device_data->snap_lock);
+  INIT_DELAYED_WORK(&device_data->poll_work, galeos_poll_work);
+  INIT_DELAYED_WORK(&device_data->pm_work, galeos_pm_work);
+  INIT_DELAYED_WORK(&device_data->wb_work, galeos_wb_work);
+  INIT_DELAYED_WORK(&device_data->cal_work, galeos_cal_work);
+  INIT_WORK(&device_data->init_work, galeos_init_work);
+  INIT_WORK(&device_data->xfer_work, galeos_xfer_work);
+  init_completion(&device_data->init_done);
+  device_data->poll_interval = poll_interval;
+  device_data->xfer_page = GALEOS_PAGE_NONE;
+  device_data->xfer_resync = GALEOS_PAGE_NONE;
+  // DMA-safe transfer buffer: plain kmalloc is cacheline aligned,
+  // devm_kmalloc data follows the devres header on older kernels
+  device_data->xfer_buf = kmalloc(GALEOS_XFER_BUF_LEN, GFP_KERNEL);
+  if(!device_data->xfer_buf)
+  {
+    spi_dev_put(spi);
+    kfree(device_data);
+    return -ENOMEM;
+  }
+  device_data->regmap_ops = devm_kmalloc_array(&spi->dev, GALEOS_REGMAP_CHUNK,
+                                               sizeof(struct galeos_reg_op), GFP_KERNEL);
+  if(!device_data->regmap_ops)
+  {
+    spi_dev_put(spi);
+    kfree(device_data->xfer_buf);
+    kfree(device_data);
+    return -ENOMEM;
+  }
+  // Register map with the channel page window on 0x7F
+  device_data->regmap = devm_regmap_init(&spi->dev, &galeos_regmap_bus, device_data, &galeos_regmap_config);
+  if(IS_ERR(device_data->regmap))
+  {
+    status = PTR_ERR(device_data->regmap);
+    dev_err(&spi->dev, "regmap init failed\n");
+    spi_dev_put(spi);
+    kfree(device_data->xfer_buf);
+    kfree(device_data);
+    return status;
+  }
   // Assign workqueue
   if(workqueue)
     device_data->workqueue = workqueue;
   // Register device
   mutex_lock(&device_list_lock);
+  device_data->bus = galeos_bus_get(spi->master);
+  if(!device_data->bus)
+  {
+    mutex_unlock(&device_list_lock);
+    spi_dev_put(spi);
+    kfree(device_data->xfer_buf);
+    kfree(device_data);
+    return -ENOMEM;
+  }
   minor = find_first_zero_bit(minors, GALEOS_MAX_DEVICES);
   if (minor < GALEOS_MAX_DEVICES) {
-    device_data->devt = MKDEV(GALEOS_MAJOR, minor);
+    device_data->devt = MKDEV(major, minor);
     //device_data->device = device_create(galeos_class, &(spi->dev), device_data->devt, NULL, GALEOS_DEVICE_NAME"%d.%d",spi->master->bus_num, spi->chip_select);
     device_data->device = device_create_with_groups(galeos_class, &(spi->dev), device_data->devt, device_data, dev_attr_grps, GALEOS_DEVICE_NAME"%d.%d",spi->master->bus_num, spi->chip_select);
     status = PTR_ERR_OR_ZERO(device_data->device);
     if(IS_ERR(device_data->device))
     {
+      galeos_bus_put(device_data->bus);
+      mutex_unlock(&device_list_lock);
+      spi_dev_put(spi);
+      kfree(device_data->xfer_buf);
       kfree(device_data);
       return status;
     }
@@ -448,6 +3464,10 @@ static int galeosspidev_probe(struct spi_device *spi)
   } else {
     dev_dbg(&spi->dev, "no minor number available!\n");
     status = -ENODEV;
+    galeos_bus_put(device_data->bus);
+    mutex_unlock(&device_list_lock);
+    spi_dev_put(spi);
+    kfree(device_data->xfer_buf);
     kfree(device_data);
     return status;
   }
@@ -456,72 +3476,95 @@ static int galeosspidev_probe(struct spi_device *spi)
     list_add(&device_data->device_entry, &device_list);
   }
   mutex_unlock(&device_list_lock);
-  // SPI speed
-  ptr = of_get_property(spi->dev.of_node, "galeos,spi-speed", NULL);
-  if (! IS_ERR(ptr) )
+  // SPI speed and modem GPIO-s, from board data or device tree
+  pdata = dev_get_platdata(&spi->dev);
+  if(pdata)
   {
-    device_data->spi_speed_hz = (unsigned)be32_to_cpup(ptr);
+    device_data->spi_speed_hz = pdata->spi_speed_hz ? pdata->spi_speed_hz : 1000000;
+    device_data->spi_calibrate = pdata->spi_speed_hz == 0;
+    device_data->gpio_ac = pdata->gpio_ac;
+    device_data->gpio_reset = pdata->gpio_reset;
+    device_data->gpio_irq = pdata->gpio_irq;
+    device_data->gpio_rdy = pdata->gpio_rdy;
   }
   else
   {
-    device_data->spi_speed_hz = 1000000;
+    ptr = of_get_property(spi->dev.of_node, "galeos,spi-speed", NULL);
+    if (ptr)
+    {
+      device_data->spi_speed_hz = (unsigned)be32_to_cpup(ptr);
+    }
+    else
+    {
+      device_data->spi_speed_hz = 1000000;
+      device_data->spi_calibrate = true;
+    }
+    number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-ac");
+    if(! IS_ERR(number))
+      device_data->gpio_ac = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-ac", 0);
+    else device_data->gpio_ac = 0;
+    number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-reset");
+    if(! IS_ERR(number))
+      device_data->gpio_reset = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-reset", 0);
+    else device_data->gpio_reset = 0;
+    number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-irq");
+    if(! IS_ERR(number))
+      device_data->gpio_irq = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-irq", 0);
+    else device_data->gpio_irq = 0;
+    number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-rdy");
+    if(! IS_ERR(number))
+      device_data->gpio_rdy = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-rdy", 0);
+    else device_data->gpio_rdy = 0;
+  }
+  device_data->spi_max_hz = spi->max_speed_hz;
+  if(device_data->spi_max_hz && device_data->spi_speed_hz > device_data->spi_max_hz)
+    device_data->spi_speed_hz = device_data->spi_max_hz;
+  // Performance monitoring history, mapped by userspace
+  if(pm_collect)
+  {
+    device_data->pm = vmalloc_user(PAGE_ALIGN(GALEOS_PM_RING_SIZE));
+    if(device_data->pm)
+      device_data->pm->version = GALEOS_PM_VERSION;
+    else
+      dev_warn(&spi->dev, "no memory for the performance monitoring history\n");
   }
-  // Find and register GPIO-s for controling device  
-  number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-ac");
-  if(! IS_ERR(number))
+  // Live status page, mapped by userspace
+  device_data->live = vmalloc_user(PAGE_SIZE);
+  if(device_data->live)
+    device_data->live->version = GALEOS_LIVE_VERSION;
+  else
+    dev_warn(&spi->dev, "no memory for the live status page\n");
+  // Register GPIO-s for controling device
+  if(device_data->gpio_ac)
   {
-    device_data->gpio_ac = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-ac", 0);
     gpio_request(device_data->gpio_ac,"galeos-gpio-ac");
     gpio_export(device_data->gpio_ac,true);
     gpio_direction_output(device_data->gpio_ac,1);
     gpio_set_value(device_data->gpio_ac,1);
-  } else device_data->gpio_ac = 0;
-  number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-reset");
-  if(! IS_ERR(number))
+  }
+  if(device_data->gpio_reset)
   {
-    device_data->gpio_reset = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-reset", 0);
     gpio_request(device_data->gpio_reset,"galeos-gpio-reset");
     gpio_export(device_data->gpio_reset,true);
     gpio_direction_output(device_data->gpio_reset,1);
     gpio_set_value(device_data->gpio_reset,1);
-  } else device_data->gpio_reset = 0;
-  number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-irq");
-  if(! IS_ERR(number))
+  }
+  if(device_data->gpio_irq)
   {
-    device_data->gpio_irq = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-irq", 0);
     gpio_request(device_data->gpio_irq,"galeos-gpio-irq");
     gpio_export(device_data->gpio_irq,true);
     gpio_direction_input(device_data->gpio_irq);
-  } else device_data->gpio_irq = 0;
-  number = of_gpio_named_count(spi->dev.of_node, "galeos,gpio-rdy");
-  printk("Number gpio-rdy %d\n",number);
-  if(! IS_ERR(number))
+  }
+  if(device_data->gpio_rdy)
   {
-    printk("Number gpio-rdy %d\n",number);
-    device_data->gpio_rdy = of_get_named_gpio(spi->dev.of_node, "galeos,gpio-rdy", 0);
     gpio_request(device_data->gpio_rdy,"galeos-gpio-rdy");
     gpio_export(device_data->gpio_rdy,true);
     gpio_direction_input(device_data->gpio_rdy);
-  } else device_data->gpio_rdy = 0;
-
-  if(1)
-  {
-    struct file *f;
-    char *buff;
-    size_t n;
-#define BUF_LEN 256
-    buff = kmalloc( BUF_LEN, GFP_KERNEL );
-    strcpy( buff, "/etc/galeos/default.conf" );
-    f = filp_open(buff, O_RDONLY, 0);
-    if( ! IS_ERR( f ) ) {
-      printk("File is opened");
-      n = kernel_read( f, 0, buff, BUF_LEN );
-      printk("Read file: %s", buff);
-      filp_close( f, NULL );
-    }
-    kfree(buff);
   }
-  mutex_init(&device_data->spi_lock);
+
+  galeos_debugfs_init(device_data);
+  // Reset and identification run in the background
+  queue_work(system_unbound_wq, &device_data->init_work);
 //  if (status == 0)
 //    spi_set_drvdata(spi, device_data);
 //  else
@@ -533,11 +3576,41 @@ static int daleosspidev_remove(struct spi_device *spi)
 {
   galeosdev_data_t *device_data = spi_get_drvdata(spi);
   /* make sure ops on existing fds can abort cleanly */
-  printk(KERN_EMERG "Galeos SPI Driver Remove...\n");
+  dev_dbg(&spi->dev, "remove\n");
+  /* held writes go out while the modem is still reachable */
+  cancel_delayed_work_sync(&device_data->wb_work);
+  mutex_lock(&device_data->spi_lock);
+  device_data->wb_delay = 0;
+  galeos_wb_flush(device_data);
+  mutex_unlock(&device_data->spi_lock);
+  cancel_work_sync(&device_data->init_work);
+  complete_all(&device_data->init_done);
+  /* the level interrupt is only acked by reading the modem, release it first */
+  if(device_data->irq)
+    free_irq(device_data->irq, device_data);
   spi_dev_put(spi);
   spin_lock_irq(&device_data->spin_lock);
   device_data->spi = NULL;
   spin_unlock_irq(&device_data->spin_lock);
+  /* wait for spi_lock holders that still saw the device, see galeos_lock_present() */
+  mutex_lock(&device_data->spi_lock);
+  mutex_unlock(&device_data->spi_lock);
+  WRITE_ONCE(device_data->poll_interval, 0);
+  cancel_delayed_work_sync(&device_data->poll_work);
+  cancel_delayed_work_sync(&device_data->pm_work);
+  cancel_delayed_work_sync(&device_data->wb_work);
+  cancel_delayed_work_sync(&device_data->cal_work);
+  /* let queued register requests drain */
+  wait_event(device_data->xfer_idle, atomic_read(&device_data->xfer_pending) == 0 &&
+                                     atomic_read(&device_data->fw_pending) == 0);
+  /* the last request ends before its work item lets go of the bus */
+  flush_work(&device_data->xfer_work);
+  if(device_data->rdy_irq)
+    free_irq(device_data->rdy_irq, device_data);
+  del_timer_sync(&device_data->rdy_timer);
+  kfree(device_data->xfer_buf);
+  /* the work items of this device are cancelled above, the workqueue is shared */
+  debugfs_remove_recursive(device_data->debugfs);
 
   if(device_data->gpio_ac)
 	  gpio_free(device_data->gpio_ac);
@@ -553,8 +3626,13 @@ static int daleosspidev_remove(struct spi_device *spi)
   list_del(&device_data->device_entry);
   device_destroy(galeos_class, device_data->devt);
   clear_bit(MINOR(device_data->devt), minors);
-  if (users == 0)
-  	kfree(device_data);
+  galeos_bus_put(device_data->bus);
+  if (device_data->users == 0)
+  {
+    vfree(device_data->pm);
+    vfree(device_data->live);
+    kfree(device_data);
+  }
   mutex_unlock(&device_list_lock);
   return 0;
 }
@@ -566,50 +3644,94 @@ static struct spi_driver galeos_spi_driver = {
     .name = GALEOS_DRIVER_NAME,
     .owner = THIS_MODULE,
     .of_match_table = galeos_of_match,
+    .probe_type = PROBE_PREFER_ASYNCHRONOUS,
   },
 };
 
 static int __init galeos_init(void){
-  int ret = 0;
-  dev_t dev;
-  struct device *device;
-  printk(KERN_EMERG "Galeos Driver initialize (init)...\n");
+  int ret;
+  pr_debug("init\n");
+  ret = galeos_chan_attrs_init();
+  if(ret)
+    return ret;
   workqueue = create_workqueue( GALEOS_WORKQUEUE_NAME );
-  if(IS_ERR(workqueue))
+  if(!workqueue)
+  {
+    pr_err("can't create the workqueue\n");
+    ret = -ENOMEM;
+    goto err_attrs;
+  }
+  galeos_fleet_wq = alloc_workqueue("galeos-fleet", WQ_UNBOUND, 0);
+  if(!galeos_fleet_wq)
+  {
+    pr_err("can't create the fleet workqueue\n");
+    ret = -ENOMEM;
+    goto err_workqueue;
+  }
+  ret = register_chrdev(major, GALEOS_MODULE_NAME, &galeos_fops);
+  if(ret < 0)
   {
-    printk(KERN_EMERG "Galeos Driver init Workqueue faild...\n");
-    return -1;
+    pr_err("can't register the character device: %d\n", ret);
+    goto err_fleet_wq;
   }
-  printk(KERN_EMERG "Galeos WorkQueue created\n");
+  if(major == 0)
+    major = ret;
   galeos_class = class_create(THIS_MODULE, GALEOS_CLASS_NAME);
   if(IS_ERR(galeos_class))
   {
-    printk(KERN_EMERG "Galeos Driver create class faild...\n");
-    flush_workqueue( workqueue );
-    return -1;
+    ret = PTR_ERR(galeos_class);
+    pr_err("can't create the device class: %d\n", ret);
+    goto err_chrdev;
+  }
+  galeos_debugfs_root = debugfs_create_dir(GALEOS_CLASS_NAME, NULL);
+  ret = genl_register_family(&galeos_genl_family);
+  if(ret)
+  {
+    pr_err("can't register the netlink family: %d\n", ret);
+    goto err_class;
   }
-  printk(KERN_EMERG "Galeos Class created\n");
   ret = spi_register_driver(&galeos_spi_driver);
-  printk(KERN_EMERG "Galeos driver registered\n");
-  if(IS_ERR(ret))
+  if(ret)
   {
-    printk(KERN_EMERG "Galeos Driver register spi driver faild...\n");
-    flush_workqueue( workqueue );
-    destroy_workqueue( workqueue );
-    class_destroy(galeos_class);
-    return ret;
+    pr_err("can't register the SPI driver: %d\n", ret);
+    goto err_genl;
   }
+  pr_info("driver %d.%d registered\n", GALEOS_DRIVER_VERSION_MAJ, GALEOS_DRIVER_VERSION_MIN);
   return 0;
+
+err_genl:
+  genl_unregister_family(&galeos_genl_family);
+err_class:
+  debugfs_remove_recursive(galeos_debugfs_root);
+  class_destroy(galeos_class);
+err_chrdev:
+  unregister_chrdev(major, GALEOS_MODULE_NAME);
+err_fleet_wq:
+  destroy_workqueue( galeos_fleet_wq );
+err_workqueue:
+  destroy_workqueue( workqueue );
+err_attrs:
+  kfree(galeos_chan_attrs);
+  return ret;
 }
 
 
 static void __exit galeos_exit(void){
-  printk(KERN_EMERG "Galeos Driver deinicialize (exit)...\n");
+  pr_debug("exit\n");
+  spi_unregister_driver(&galeos_spi_driver);
+  genl_unregister_family(&galeos_genl_family);
+  destroy_workqueue( galeos_fleet_wq );
   flush_workqueue( workqueue );
   destroy_workqueue( workqueue );
-  spi_unregister_driver(&galeos_spi_driver);
+  debugfs_remove_recursive(galeos_debugfs_root);
   class_destroy(galeos_class);
+  unregister_chrdev(major, GALEOS_MODULE_NAME);
+  kfree(galeos_chan_attrs);
 }
 
 module_init(galeos_init);
 module_exit(galeos_exit);
+
+#if IS_ENABLED(CONFIG_GALEOS_KUNIT_TEST)
+#include "galeos_test.c"
+#endif
@@ -13,8 +13,137 @@
 #include <linux/sched.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/interrupt.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/log2.h>
+#include <linux/delay.h>
 
 #include <linux/kdev_t.h>
+#include <linux/uaccess.h>
+#include <linux/regmap.h>
+#include <linux/firmware.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/cache.h>
+#include <net/genetlink.h>
+
+#include "galeos_ioctl.h"
+
+struct galeos_work_s;
+
+/* log2(ns) latency buckets, the last one collects everything above */
+#define GALEOS_HIST_BUCKETS 32
+
+/*
+ * SPI statistics of one device. The engine updates them from the SPI
+ * completion and lock waits are recorded by the spi_lock holder, so no
+ * extra locking; a reset racing an update may lose that update.
+ */
+typedef struct galeos_stats_s {
+  u64 reads;
+  u64 writes;
+  u64 page_switches;
+  u64 errors;
+  u64 requests;
+  u64 lock_acquisitions;
+  u64 lock_wait_ns;
+  u64 rdy_waits;     /* phases that waited for the gpio_rdy edge */
+  u64 rdy_timeouts;
+  u64 lock_hist[GALEOS_HIST_BUCKETS];    /* spi_lock wait */
+  u64 access_hist[GALEOS_HIST_BUCKETS];  /* address + data phase of one register */
+  u64 request_hist[GALEOS_HIST_BUCKETS]; /* engine request, submission to completion */
+} galeos_stats_t;
+
+/* Board data for modems instantiated without device tree (e.g. galeos-sim) */
+struct galeos_platform_data {
+  unsigned spi_speed_hz;
+  int gpio_ac;
+  int gpio_reset;
+  int gpio_irq;
+  int gpio_rdy;
+};
+
+/*
+ * regmap address space: 0x00..0x7F are accessed directly, channel page N
+ * register R is virtual register GALEOS_PAGED_REG(N, R).
+ */
+#define GALEOS_PAGES        GALEOS_CHANNELS
+#define GALEOS_PAGE_LEN     0x80
+#define GALEOS_PAGED_BASE   0x100
+#define GALEOS_PAGED_REG(page, reg) (GALEOS_PAGED_BASE + (page) * GALEOS_PAGE_LEN + (reg))
+#define GALEOS_PAGED_PAGE(vreg)     (((vreg) - GALEOS_PAGED_BASE) / GALEOS_PAGE_LEN)
+#define GALEOS_PAGED_OFFSET(vreg)   (((vreg) - GALEOS_PAGED_BASE) % GALEOS_PAGE_LEN)
+#define GALEOS_MAX_REGISTER (GALEOS_PAGED_REG(GALEOS_PAGES, 0) - 1)
+
+/* galeos-sim bus trace, used by the KUnit suite (galeos_test.c) */
+#define GALEOS_SIM_LOG_LEN ((GALEOS_PAGES + 1) * GALEOS_PAGE_LEN)
+
+typedef struct {
+  u8  modem;
+  u8  page;   /* page selected in the modem before the access */
+  u8  reg;
+  u8  value;
+  bool read;
+} galeos_sim_access_t;
+
+typedef struct {
+  unsigned messages;
+  unsigned transfers;
+  unsigned accesses;    /* data phases, the first GALEOS_SIM_LOG_LEN are logged */
+  unsigned cs_overlaps; /* transfers while another chip select was asserted */
+  galeos_sim_access_t log[GALEOS_SIM_LOG_LEN];
+} galeos_sim_trace_t;
+
+struct spi_device *galeos_sim_spi( unsigned modem );
+void galeos_sim_trace( galeos_sim_trace_t *trace );
+void galeos_sim_drop_rdy( unsigned modem, unsigned accesses );
+void galeos_sim_raise_rdy( unsigned modem );
+void galeos_sim_raise_irq( unsigned modem, u8 channels );
+
+/* Transfer buffer: the tx byte of a phase, the rx byte in its own cacheline */
+#define GALEOS_XFER_RX      L1_CACHE_BYTES
+#define GALEOS_XFER_BUF_LEN (2 * L1_CACHE_BYTES)
+#define GALEOS_REGMAP_CHUNK GALEOS_PAGE_LEN /* registers per regmap bus request */
+
+/* Channel registers captured by the status poller */
+typedef struct {
+  u8 mode;
+  u8 speed_hi;
+  u8 speed_lo;
+  u8 pam;
+  u8 status;
+} galeos_chan_snap_t;
+
+typedef struct {
+  ktime_t stamp;
+  bool valid;
+  galeos_chan_snap_t chan[GALEOS_CHANNELS];
+} galeos_snapshot_t;
+
+/* SPI clock calibration step, see galeos_calibrate() */
+typedef struct {
+  u32 hz;
+  u8  errors; /* read-back mismatches */
+  u8  failed; /* rounds whose transfers failed */
+} galeos_cal_step_t;
+
+#define GALEOS_CAL_STEPS      12
+#define GALEOS_CAL_ROUNDS     4  /* pattern sets per clock step */
+#define GALEOS_CAL_MARGIN_PCT 80 /* run at most at this share of the highest stable clock */
+
+/* Channel configuration written as one transaction, -1 leaves a field unchanged */
+typedef struct {
+  int speed;
+  int mode;
+  int pam;
+  bool verify;
+} galeos_chan_config_t;
 
 typedef struct galeos_data_s {
   struct list_head  device_entry;
@@ -26,23 +155,194 @@ typedef struct galeos_data_s {
   struct spi_transfer spi_transfer[2];
   struct workqueue_struct *workqueue;
   dev_t devt;
-  u8  spi_data[2];
+  u8  *xfer_buf; /* DMA-safe, GALEOS_XFER_BUF_LEN bytes */
   unsigned  spi_speed_hz;
+  unsigned  spi_max_hz; /* controller/board limit */
+  /* Clock calibration when no clock is configured, and periodic re-check */
+  bool  spi_calibrate;
+  galeos_cal_step_t cal_step[GALEOS_CAL_STEPS];
+  unsigned cal_steps;
+  unsigned cal_downshifts;
+  struct delayed_work cal_work;
+  u8  modem_type;
+  u8  modem_version;
+  /* Transfer engine, requests dispatched by the bus scheduler */
+  struct galeos_bus_s *bus;
+  atomic_t xfer_pending; /* requests queued or on the wire */
+  struct task_struct *bulk_task; /* spi_lock holder running a bulk operation */
+  struct galeos_work_s *xfer_cur;
+  struct work_struct xfer_work; /* runs xfer_cur with the SPI bus locked */
+  wait_queue_head_t xfer_idle;
+  struct galeos_reg_op *xfer_op;
+  u8  xfer_reg;
+  u8  xfer_value;
+  u8  xfer_page;
+  u8  xfer_resync; /* page the next request selects first after a failed restore */
+  /* Statistics, /sys/kernel/debug/galeos/{device}/ */
+  galeos_stats_t stats;
+  struct dentry *debugfs;
   /* Modem gpio's*/
   int gpio_ac;
   int gpio_reset;
   int gpio_irq;
   int gpio_rdy;
+  int irq;
+  /* Flow control: a request parked off the bus until gpio_rdy rises, requeued by rdy_irq or failed by rdy_timer */
+  int rdy_irq;
+  bool xfer_parked; /* under bus->lock */
+  atomic_t rdy_armed;
+  wait_queue_head_t rdy_wait; /* rdy between the phases of an access */
+  struct timer_list rdy_timer;
+  /* Channel status, updated from the modem interrupt */
+  u8  status[GALEOS_CHANNELS];
+  u32 chan_seq[GALEOS_CHANNELS];
+  u32 event_seq;
+  wait_queue_head_t event_wait;
+  /* Background status poller */
+  struct delayed_work poll_work;
+  unsigned int poll_interval;
+  seqlock_t snap_lock;
+  galeos_snapshot_t snap;
+  /* Performance monitoring, mmap-able history */
+  struct delayed_work pm_work;
+  struct galeos_pm_ring *pm;
+  u8  pm_ses_run[GALEOS_CHANNELS];
+  bool pm_unavailable[GALEOS_CHANNELS];
+  /* Live status page, mmap-able, writers serialized by live_lock, irqsave */
+  struct galeos_live *live;
+  spinlock_t live_lock;
+  /* Write-back mode: channel register writes held until flushed, under spi_lock */
+  unsigned int wb_delay; /* ms from the first held write to the flush, 0 = write-through */
+  DECLARE_BITMAP(wb_dirty, GALEOS_MAX_REGISTER + 1);
+  u8  wb_val[GALEOS_MAX_REGISTER + 1];
+  struct delayed_work wb_work;
+  /* Deferred modem bring-up, register users wait for init_done */
+  struct work_struct init_work;
+  struct completion init_done;
   /**/
+  struct regmap *regmap;
+  struct galeos_reg_op *regmap_ops; /* GALEOS_REGMAP_CHUNK ops of the regmap bus */
+  u8  page;
+  u8  reg;
   int id;
+  unsigned users;
+  atomic_t fw_pending;
 } galeosdev_data_t;
 
+/* Fleet reconfiguration, one per GALEOS_CMD_APPLY request */
+typedef struct {
+  unsigned count;
+  unsigned channel[GALEOS_CHANNELS];
+  galeos_chan_config_t cfg[GALEOS_CHANNELS];
+  atomic_t pending; /* buses not done yet */
+  struct completion done;
+} galeos_fleet_t;
+
+typedef struct {
+  struct list_head entry;
+  galeosdev_data_t *dev; /* referenced, see galeos_dev_get() */
+  int status;
+} galeos_fleet_job_t;
+
+/* The modems of one SPI bus, configured one after the other */
 typedef struct {
   struct work_struct work;
-  struct galeos_data *gdata;
-  cycles_t cycles;
+  struct list_head jobs;
+  s16 bus_num;
+  galeos_fleet_t *fleet;
+} galeos_fleet_bus_t;
+
+/*
+ * Per-channel parameter behind the DSL/<name><channel> attributes.
+ * Register parameters cover width consecutive registers from reg on the
+ * channel page, most significant first, with lo_bits used in the
+ * following ones; value = raw * scale. The others have show/store.
+ */
+#define GALEOS_PARAM_WIDTH_MAX 2
+
+typedef struct galeos_chan_param_s {
+  const char *name;
+  u8  reg;
+  u8  width;
+  u8  lo_bits;
+  u8  scale;
+  bool sign;      /* single signed register */
+  bool vol;       /* volatile, not held in the register cache */
+  u8  snap;       /* GALEOS_SNAP() offset in galeos_chan_snap_t, 0 if not polled */
+  ssize_t (*decode)(const struct galeos_chan_param_s *p, const u8 *regs, char *buf);
+  int (*encode)(const struct galeos_chan_param_s *p, const char *buf, u8 *regs);
+  ssize_t (*show)(galeosdev_data_t *dev, unsigned channel, char *buf);
+  ssize_t (*store)(galeosdev_data_t *dev, unsigned channel, const char *buf, size_t count);
+} galeos_chan_param_t;
+
+typedef struct {
+  struct device_attribute attr;
+  const galeos_chan_param_t *param;
+  unsigned channel;
+  char name[24];
+} galeos_chan_attr_t;
+
+/* Per open file state of the character device */
+typedef struct galeos_file_s {
+  galeosdev_data_t *gdata;
+  u32 chan_seq[GALEOS_CHANNELS];
+  u8  page; /* page of the 0x00..0x7F window, under spi_lock */
+} galeos_file_t;
+
+/*
+ * Register request: ops are executed in order by the transfer engine,
+ * then done is completed. The submitter waits for it, see galeos_xfer_sync().
+ */
+typedef struct galeos_work_s {
+  struct galeos_data_s *gdata;
+  ktime_t queued;
+  struct list_head entry;
+  struct spi_device *spi;
+  struct galeos_reg_op *ops;
+  unsigned count;
+  unsigned pos;
+  unsigned slice_end; /* 0 until dispatched */
+  u8  prio;           /* GALEOS_PRIO_* */
+  ktime_t waiting;    /* queued on the bus */
+  u8  restore_page;
+  int status;
+  struct completion done;
 } galeos_work_t;
-#define GALEOS_MAJOR       1
+
+/*
+ * Per-bus scheduler: requests of all modems on one SPI controller go
+ * through its queues, one request or slice on the wire at a time.
+ * Interactive requests (status, alarms, attributes) go before bulk ones
+ * (register map, batches, profiles), which run in slices of at most
+ * GALEOS_SLICE_OPS operations.
+ */
+enum {
+  GALEOS_PRIO_INTERACTIVE,
+  GALEOS_PRIO_BULK,
+  GALEOS_PRIOS,
+};
+
+#define GALEOS_SLICE_OPS 16
+
+typedef struct {
+  u64 queued;       /* requests */
+  u64 dispatched;   /* requests and bulk slices put on the wire */
+  u64 wait_ns;
+  u64 max_wait_ns;
+  unsigned depth;
+  unsigned max_depth;
+} galeos_prio_stats_t;
+
+typedef struct galeos_bus_s {
+  struct list_head entry;
+  struct spi_master *master;
+  unsigned refs;    /* under device_list_lock */
+  spinlock_t lock;
+  struct list_head queue[GALEOS_PRIOS];
+  galeos_work_t *cur;
+  galeos_prio_stats_t stats[GALEOS_PRIOS];
+} galeos_bus_t;
+
 #define GALEOS_MAX_DEVICES 10
 #define GALEOS_DRIVER_NAME "shdsl-bNv"
 #define GALEOS_MODULE_NAME "shdsl"
@@ -51,7 +351,41 @@ typedef struct {
 #define GALEOS_WORKQUEUE_NAME GALEOS_CLASS_NAME "-" GALEOS_DRIVER_NAME
 
 #define GALEOS_DRIVER_VERSION_MAJ 0
-#define GALEOS_DRIVER_VERSION_MIN 2
+#define GALEOS_DRIVER_VERSION_MIN 3
+
+/* Performance monitoring (G.991.2 second classification) */
+#define GALEOS_PM_SES_CRC   50 /* CRC anomalies making a second severely errored */
+#define GALEOS_PM_UAS_RUN   10 /* consecutive seconds entering/leaving unavailability */
+#define GALEOS_PM_15MIN_SEC (15 * 60)
+#define GALEOS_PM_24H_SEC   (24 * 60 * 60)
+
+/* Modem bring-up */
+#define GALEOS_RESET_MS          10
+#define GALEOS_READY_TIMEOUT_MS  1000
+#define GALEOS_READY_POLL_MS     5
+#define GALEOS_RDY_SPIN_US       10 /* busy wait for gpio_rdy before waiting for its edge */
+#define GALEOS_RDY_TIMEOUT_MS    100
+#define GALEOS_RDY_PHASE_MS      2 /* wait between address and data phase, chip select asserted */
+
+/* Modem registers */
+#define GALEOS_REG_TYPE     0x60
+#define GALEOS_REG_VERSION  0x61
+#define GALEOS_REG_IRQ      0x62 /* channel interrupt summary, bit N = channel N, clear on read */
+#define GALEOS_REG_SCRATCH  0x63 /* no function, used for clock calibration */
+#define GALEOS_REG_PAGE     0x7F
+
+/* Per-channel registers, on the page selected through GALEOS_REG_PAGE */
+#define GALEOS_REG_MODE     0x01
+#define GALEOS_REG_SPEED_HI 0x02
+#define GALEOS_REG_SPEED_LO 0x03
+#define GALEOS_REG_PAM      0x0C
+#define GALEOS_REG_STATUS   0x40 /* GALEOS_STATUS_* */
+#define GALEOS_REG_CRC      0x41 /* CRC anomalies since the last read, clear on read */
+#define GALEOS_REG_SNR_MARGIN 0x42 /* SNR margin, dB, signed */
+#define GALEOS_REG_LATN     0x43 /* loop attenuation, dB */
+#define GALEOS_REG_RATE_HI  0x44 /* actual line rate, encoded like speed */
+#define GALEOS_REG_RATE_LO  0x45
+
 
 
 #endif//__GALEOS_H__
@@ -0,0 +1,219 @@
+#ifndef __GALEOS_IOCTL_H__
+#define __GALEOS_IOCTL_H__
+
+/* Userspace interface of the /dev/shdslB.C character device */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define GALEOS_IOC_MAGIC 'G'
+
+/* galeos_reg_op.op */
+#define GALEOS_OP_READ   0
+#define GALEOS_OP_WRITE  1
+
+/* galeos_reg_op.page: access the register on the page last written to 0x7F */
+#define GALEOS_PAGE_NONE 0xFF
+
+/* Highest register number a batch entry may address (0x7F is the page register) */
+#define GALEOS_REG_MAX   0x7E
+
+/* Maximum number of entries in one GALEOS_IOC_BATCH call */
+#define GALEOS_BATCH_MAX 1024
+
+struct galeos_reg_op {
+  __u8 page;   /* 0..3 or GALEOS_PAGE_NONE */
+  __u8 reg;    /* 0x00..GALEOS_REG_MAX */
+  __u8 value;  /* written value, or read result on return */
+  __u8 op;     /* GALEOS_OP_READ / GALEOS_OP_WRITE */
+};
+
+struct galeos_batch {
+  __u32 count; /* number of entries in ops */
+  __u32 flags; /* reserved, must be 0 */
+  __u64 ops;   /* user pointer to struct galeos_reg_op[count] */
+};
+
+/*
+ * Run all entries of the batch in order under one device lock hold.
+ * Page switches are only issued when the page actually changes.
+ */
+#define GALEOS_IOC_BATCH _IOWR(GALEOS_IOC_MAGIC, 1, struct galeos_batch)
+
+/*
+ * read()/write()/pread()/pwrite() offsets: 0x00..0x7F are the registers on
+ * the page last written to 0x7F, GALEOS_FILE_REG(page, reg) addresses a
+ * register of a channel page directly. One call stays within one area.
+ */
+#define GALEOS_FILE_REG(page, reg) (0x100 + (page) * 0x80 + (reg))
+
+/* Channel line status bits (per-channel status register) */
+#define GALEOS_STATUS_LINK 0x01 /* link up */
+#define GALEOS_STATUS_LOSW 0x02 /* loss of sync word */
+#define GALEOS_STATUS_LOS  0x04 /* loss of signal */
+#define GALEOS_STATUS_SNRM 0x08 /* SNR margin below threshold */
+#define GALEOS_STATUS_LATN 0x10 /* loop attenuation above threshold */
+
+#define GALEOS_CHANNELS 4
+
+struct galeos_events {
+  __u32 seq;                      /* device event counter */
+  __u8  changed;                  /* bit N: channel N changed since the last call on this file */
+  __u8  status[GALEOS_CHANNELS];  /* GALEOS_STATUS_* of every channel */
+  __u8  reserved[3];
+};
+
+/*
+ * Fetch the channel status and the set of channels that changed since
+ * the previous call on the same file. poll() on the device reports
+ * POLLIN | POLLPRI while there are changes not yet fetched.
+ */
+#define GALEOS_IOC_EVENTS _IOR(GALEOS_IOC_MAGIC, 2, struct galeos_events)
+
+/*
+ * SHDSL performance monitoring history, mmap() of the character device
+ * at offset 0 (read-only, GALEOS_PM_RING_SIZE rounded up to pages). The
+ * driver samples every channel once per second and accumulates the
+ * current 15-minute and 24-hour bins; bins start on wall clock
+ * boundaries (UTC). seq is odd while the driver updates the ring:
+ * readers copy what they need and retry if seq changed or was odd.
+ */
+#define GALEOS_PM_VERSION   1
+#define GALEOS_PM_15MIN     96  /* 24 hours of 15-minute bins */
+#define GALEOS_PM_24H       7   /* a week of 24-hour bins */
+
+struct galeos_pm_counters {
+  __u32 crc;  /* CRC anomalies */
+  __u32 es;   /* errored seconds */
+  __u32 ses;  /* severely errored seconds */
+  __u32 uas;  /* unavailable seconds */
+};
+
+struct galeos_pm_bin {
+  __u64 start;    /* seconds since the epoch, 0 for a bin never used */
+  __u32 elapsed;  /* seconds sampled in this bin */
+  __u32 reserved;
+  struct galeos_pm_counters chan[GALEOS_CHANNELS];
+};
+
+struct galeos_pm_ring {
+  __u32 version;  /* GALEOS_PM_VERSION */
+  __u32 seq;
+  __u32 cur_15min;  /* index of the current bin in bins_15min */
+  __u32 cur_24h;    /* index of the current bin in bins_24h */
+  struct galeos_pm_bin bins_15min[GALEOS_PM_15MIN];
+  struct galeos_pm_bin bins_24h[GALEOS_PM_24H];
+};
+
+#define GALEOS_PM_RING_SIZE sizeof(struct galeos_pm_ring)
+
+/*
+ * Live channel status, mmap() of the character device at offset
+ * GALEOS_MMAP_LIVE (read-only, one page). The driver updates it whenever
+ * it learns the configuration or status of a channel: interrupts, the
+ * poller, refresh and its own register writes. seq is odd during an
+ * update: readers copy the page and retry if seq changed or was odd.
+ * chan[N].seq counts the changes of channel N.
+ */
+#define GALEOS_LIVE_VERSION 1
+#define GALEOS_MMAP_LIVE    0x100000
+
+struct galeos_live_chan {
+  __u32 seq;
+  __u32 speed;   /* configured speed, kbit/s */
+  __u8  mode;    /* mode register, 0x00 COT, 0x01 RTA, 0xFF off */
+  __u8  pam;     /* PAM level, 0 for auto */
+  __u8  link;    /* 1 when the link is up */
+  __u8  alarms;  /* GALEOS_STATUS_* other than GALEOS_STATUS_LINK */
+};
+
+struct galeos_live {
+  __u32 version;  /* GALEOS_LIVE_VERSION */
+  __u32 seq;
+  __u64 stamp_ns; /* CLOCK_MONOTONIC of the last update */
+  struct galeos_live_chan chan[GALEOS_CHANNELS];
+};
+
+/*
+ * Generic netlink family GALEOS_GENL_NAME for fleet monitoring.
+ * GALEOS_CMD_GET as a dump returns one message per modem: GALEOS_A_DEVICE,
+ * GALEOS_A_STATUS and a GALEOS_A_CHANNEL nest per channel with its
+ * configuration and status. If the configuration could not be read,
+ * GALEOS_A_STATUS is the error and the nests carry index and status only.
+ * GALEOS_CMD_SET (CAP_NET_ADMIN) takes GALEOS_A_DEVICE and up to
+ * GALEOS_CHANNELS GALEOS_A_CHANNEL nests, each with GALEOS_A_CH_INDEX and
+ * the values to change; all nests are checked before any is applied, then
+ * every channel is applied as one transaction, in order. Status changes are multicast to GALEOS_GENL_MCGRP_EVENTS as
+ * GALEOS_CMD_EVENT with the changed channels (index and status only).
+ * GALEOS_CMD_APPLY (CAP_NET_ADMIN) applies up to GALEOS_CHANNELS
+ * GALEOS_A_CHANNEL nests to every modem named by a GALEOS_A_DEVICE, or to
+ * all modems without one; modems on different SPI buses are configured
+ * in parallel. The reply has a GALEOS_A_RESULT nest per modem.
+ */
+#define GALEOS_GENL_NAME         "galeos"
+#define GALEOS_GENL_VERSION      1
+#define GALEOS_GENL_MCGRP_EVENTS "events"
+
+enum {
+  GALEOS_CMD_UNSPEC,
+  GALEOS_CMD_GET,
+  GALEOS_CMD_SET,
+  GALEOS_CMD_EVENT,
+  GALEOS_CMD_APPLY,
+  __GALEOS_CMD_MAX,
+};
+#define GALEOS_CMD_MAX (__GALEOS_CMD_MAX - 1)
+
+enum {
+  GALEOS_A_UNSPEC,
+  GALEOS_A_DEVICE,   /* string, device name as in /sys/class/galeos */
+  GALEOS_A_CHANNEL,  /* nest of GALEOS_A_CH_* */
+  GALEOS_A_RESULT,   /* nest of GALEOS_A_RES_*, APPLY reply */
+  GALEOS_A_STATUS,   /* s32, GET dump: 0 or -errno of the configuration read */
+  __GALEOS_A_MAX,
+};
+#define GALEOS_A_MAX (__GALEOS_A_MAX - 1)
+
+enum {
+  GALEOS_A_RES_UNSPEC,
+  GALEOS_A_RES_DEVICE, /* string */
+  GALEOS_A_RES_STATUS, /* s32, 0 or -errno */
+  __GALEOS_A_RES_MAX,
+};
+#define GALEOS_A_RES_MAX (__GALEOS_A_RES_MAX - 1)
+
+enum {
+  GALEOS_A_CH_UNSPEC,
+  GALEOS_A_CH_INDEX,   /* u8 */
+  GALEOS_A_CH_SPEED,   /* u32, kbit/s in 8 kbit/s steps */
+  GALEOS_A_CH_MODE,    /* u8, mode register value */
+  GALEOS_A_CH_PAM,     /* u8, PAM level, 0 for auto */
+  GALEOS_A_CH_STATUS,  /* u8, GALEOS_STATUS_* */
+  GALEOS_A_CH_VERIFY,  /* flag, SET only: read the registers back */
+  __GALEOS_A_CH_MAX,
+};
+#define GALEOS_A_CH_MAX (__GALEOS_A_CH_MAX - 1)
+
+/*
+ * Per-device register profile, loaded through the firmware loader as
+ * galeos/<model>-<bus>.<cs>.bin (e.g. galeos/shdsl-b4v-0.1.bin) when the
+ * device is probed and on every write to the reload_profile attribute. The
+ * header is followed by count entries that are written in order; page is a
+ * channel page or GALEOS_PAGE_NONE, reg is at most GALEOS_REG_MAX.
+ */
+#define GALEOS_PROFILE_MAGIC   "GLPF"
+#define GALEOS_PROFILE_VERSION 1
+
+struct galeos_profile_header {
+  char   magic[4];  /* GALEOS_PROFILE_MAGIC */
+  __le16 version;   /* GALEOS_PROFILE_VERSION */
+  __le16 count;     /* number of entries, at most GALEOS_BATCH_MAX */
+};
+
+struct galeos_profile_entry {
+  __u8 page;
+  __u8 reg;
+  __u8 value;
+};
+
+#endif//__GALEOS_IOCTL_H__
@@ -0,0 +1,471 @@
+/*
+ * KUnit suite for the register paths of the driver. galeos.c includes it
+ * when CONFIG_GALEOS_KUNIT_TEST is set, so the attribute handlers are
+ * called directly. It runs against modem 0 of galeos-sim in its default
+ * state and checks the SPI traffic of every public register operation:
+ * the register accesses in order, with page, value and direction, and
+ * exactly two messages (address and data phase) per access. A change that
+ * adds bus traffic to one of these operations fails here. The interrupt
+ * and gpio_rdy cases drive the lines of the simulated modem.
+ *
+ *   ./tools/testing/kunit/kunit.py run --arch=x86_64 --kunitconfig=<this directory>
+ */
+#include <kunit/test.h>
+
+typedef struct {
+  galeosdev_data_t *dev;
+  galeos_sim_trace_t *trace;
+  char *buf;
+} galeos_test_t;
+
+/* One expected register access on the wire */
+typedef struct {
+  u8  page;
+  u8  reg;
+  u8  value;
+  bool read;
+} galeos_test_access_t;
+
+#define GALEOS_TEST_R(p, r, v) { .page = (p), .reg = (r), .value = (v), .read = true }
+#define GALEOS_TEST_W(p, r, v) { .page = (p), .reg = (r), .value = (v), .read = false }
+
+#define GALEOS_SIM_SPEED 2304 /* galeos-sim channel defaults */
+#define GALEOS_SIM_PAM   16
+
+static int galeos_test_init( struct kunit *test )
+{
+  galeos_test_t *t;
+  struct spi_device *spi;
+
+  t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t);
+  t->trace = kunit_kzalloc(test, sizeof(*t->trace), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->trace);
+  t->buf = kunit_kzalloc(test, PAGE_SIZE, GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->buf);
+
+  /* the driver probes asynchronously */
+  wait_for_device_probe();
+  spi = galeos_sim_spi(0);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, spi);
+  t->dev = spi_get_drvdata(spi);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, t->dev);
+  test->priv = t;
+  return 0;
+}
+
+/* Select page 0 outside the trace, so channel 1 accesses start with a page switch */
+static void galeos_test_page0( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  int status;
+
+  galeos_lock(t->dev);
+  status = regmap_write(t->dev->regmap, GALEOS_REG_PAGE, 0);
+  galeos_unlock(t->dev);
+  KUNIT_ASSERT_EQ(test, status, 0);
+}
+
+/* Drop cached registers, the next read goes to the modem */
+static void galeos_test_cold( struct kunit *test, unsigned channel, u8 reg, unsigned width )
+{
+  galeos_test_t *t = test->priv;
+  unsigned int vreg = GALEOS_PAGED_REG(channel, reg);
+
+  galeos_lock(t->dev);
+  regcache_drop_region(t->dev->regmap, vreg, vreg + width - 1);
+  galeos_unlock(t->dev);
+}
+
+static galeos_chan_attr_t *galeos_test_attr( struct kunit *test, const char *name, unsigned channel )
+{
+  size_t i;
+
+  for(i = 0; i < ARRAY_SIZE(galeos_chan_params); i++)
+  {
+    if(strcmp(galeos_chan_params[i].name, name) == 0)
+      break;
+  }
+  KUNIT_ASSERT_LT(test, i, ARRAY_SIZE(galeos_chan_params));
+  return &galeos_chan_attrs[i * GALEOS_CHANNELS + channel];
+}
+
+static ssize_t galeos_test_show( struct kunit *test, const char *name, unsigned channel )
+{
+  galeos_test_t *t = test->priv;
+  galeos_chan_attr_t *ca = galeos_test_attr(test, name, channel);
+  ssize_t ret;
+
+  galeos_sim_trace(t->trace);
+  ret = galeos_chan_show(t->dev->device, &ca->attr, t->buf);
+  galeos_sim_trace(NULL);
+  return ret;
+}
+
+static ssize_t galeos_test_store( struct kunit *test, const char *name, unsigned channel,
+                                  const char *value )
+{
+  galeos_test_t *t = test->priv;
+  galeos_chan_attr_t *ca = galeos_test_attr(test, name, channel);
+  ssize_t ret;
+
+  galeos_sim_trace(t->trace);
+  ret = galeos_chan_store(t->dev->device, &ca->attr, value, strlen(value));
+  galeos_sim_trace(NULL);
+  return ret;
+}
+
+/* Every access is one address and one data message, and holds chip select alone */
+static void galeos_test_expect_wire( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_sim_trace_t *tr = t->trace;
+
+  KUNIT_EXPECT_EQ(test, tr->messages, 2 * tr->accesses);
+  KUNIT_EXPECT_EQ(test, tr->transfers, 2 * tr->accesses);
+  KUNIT_EXPECT_EQ(test, tr->cs_overlaps, 0U);
+}
+
+static void galeos_test_expect( struct kunit *test, const galeos_test_access_t *seq, unsigned n )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_sim_trace_t *tr = t->trace;
+  unsigned i;
+
+  KUNIT_EXPECT_EQ(test, tr->accesses, n);
+  for(i = 0; i < n && i < tr->accesses && i < GALEOS_SIM_LOG_LEN; i++)
+  {
+    const galeos_sim_access_t *a = &tr->log[i];
+    KUNIT_EXPECT_EQ_MSG(test, a->modem, (u8)0, "access %u", i);
+    KUNIT_EXPECT_EQ_MSG(test, a->page, seq[i].page, "access %u", i);
+    KUNIT_EXPECT_EQ_MSG(test, a->reg, seq[i].reg, "access %u", i);
+    KUNIT_EXPECT_EQ_MSG(test, a->read, seq[i].read, "access %u", i);
+    KUNIT_EXPECT_EQ_MSG(test, a->value, seq[i].value, "access %u", i);
+  }
+  galeos_test_expect_wire(test);
+}
+
+static void galeos_test_device_info( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t version[] = {
+    GALEOS_TEST_R(0, GALEOS_REG_VERSION, t->dev->modem_version),
+  };
+  const galeos_test_access_t type[] = {
+    GALEOS_TEST_R(0, GALEOS_REG_TYPE, t->dev->modem_type),
+  };
+  char expect[8];
+
+  galeos_test_page0(test);
+  galeos_sim_trace(t->trace);
+  KUNIT_EXPECT_EQ(test, show_device_version(t->dev->device, &dev_attr_device_version, t->buf),
+                  (ssize_t)5);
+  galeos_sim_trace(NULL);
+  scnprintf(expect, sizeof(expect), "0x%02X\n", t->dev->modem_version);
+  KUNIT_EXPECT_STREQ(test, t->buf, expect);
+  galeos_test_expect(test, version, ARRAY_SIZE(version));
+
+  galeos_sim_trace(t->trace);
+  KUNIT_EXPECT_EQ(test, show_device_type(t->dev->device, &dev_attr_device_type, t->buf),
+                  (ssize_t)5);
+  galeos_sim_trace(NULL);
+  scnprintf(expect, sizeof(expect), "0x%02X\n", t->dev->modem_type);
+  KUNIT_EXPECT_STREQ(test, t->buf, expect);
+  galeos_test_expect(test, type, ARRAY_SIZE(type));
+}
+
+static void galeos_test_speed( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t show[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_R(1, GALEOS_REG_SPEED_HI, GALEOS_SIM_SPEED / 64),
+    GALEOS_TEST_R(1, GALEOS_REG_SPEED_LO, 0),
+  };
+  const galeos_test_access_t store[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_W(1, GALEOS_REG_SPEED_HI, 4608 / 64),
+    GALEOS_TEST_W(1, GALEOS_REG_SPEED_LO, 0),
+  };
+
+  galeos_test_cold(test, 1, GALEOS_REG_SPEED_HI, 2);
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_show(test, "speed", 1), (ssize_t)5);
+  KUNIT_EXPECT_STREQ(test, t->buf, "2304\n");
+  galeos_test_expect(test, show, ARRAY_SIZE(show));
+
+  /* served from the register cache from now on */
+  galeos_test_show(test, "speed", 1);
+  KUNIT_EXPECT_STREQ(test, t->buf, "2304\n");
+  galeos_test_expect(test, NULL, 0);
+
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "speed", 1, "4608"), (ssize_t)4);
+  galeos_test_expect(test, store, ARRAY_SIZE(store));
+  galeos_test_show(test, "speed", 1);
+  KUNIT_EXPECT_STREQ(test, t->buf, "4608\n");
+  galeos_test_expect(test, NULL, 0);
+
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "speed", 1, "2304"), (ssize_t)4);
+}
+
+static void galeos_test_mode( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t show[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_R(1, GALEOS_REG_MODE, 0),
+  };
+  const galeos_test_access_t store[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_W(1, GALEOS_REG_MODE, 1),
+  };
+
+  galeos_test_cold(test, 1, GALEOS_REG_MODE, 1);
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_show(test, "mode", 1), (ssize_t)4);
+  KUNIT_EXPECT_STREQ(test, t->buf, "COT\n");
+  galeos_test_expect(test, show, ARRAY_SIZE(show));
+
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "mode", 1, "RTA"), (ssize_t)3);
+  galeos_test_expect(test, store, ARRAY_SIZE(store));
+  galeos_test_show(test, "mode", 1);
+  KUNIT_EXPECT_STREQ(test, t->buf, "RTA\n");
+  galeos_test_expect(test, NULL, 0);
+
+  /* unknown modes are rejected before anything goes to the modem */
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "mode", 1, "CTO"), (ssize_t)-EINVAL);
+  galeos_test_expect(test, NULL, 0);
+
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "mode", 1, "COT"), (ssize_t)3);
+}
+
+static void galeos_test_pam( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t show[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_R(1, GALEOS_REG_PAM, GALEOS_SIM_PAM),
+  };
+  const galeos_test_access_t store[] = {
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_W(1, GALEOS_REG_PAM, 32),
+  };
+
+  galeos_test_cold(test, 1, GALEOS_REG_PAM, 1);
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_show(test, "pam", 1), (ssize_t)3);
+  KUNIT_EXPECT_STREQ(test, t->buf, "16\n");
+  galeos_test_expect(test, show, ARRAY_SIZE(show));
+
+  galeos_test_page0(test);
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "pam", 1, "32"), (ssize_t)2);
+  galeos_test_expect(test, store, ARRAY_SIZE(store));
+  galeos_test_show(test, "pam", 1);
+  KUNIT_EXPECT_STREQ(test, t->buf, "32\n");
+  galeos_test_expect(test, NULL, 0);
+
+  KUNIT_EXPECT_EQ(test, galeos_test_store(test, "pam", 1, "16"), (ssize_t)2);
+}
+
+/*
+ * The register map dump reads every volatile register of every page once,
+ * in order, with one page switch per page; cached registers and the page
+ * register itself cost nothing.
+ */
+static void galeos_test_regmap_dump( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  struct kobject *kobj = &t->dev->device->kobj;
+  galeos_test_access_t *seq;
+  unsigned page, reg, n = 0;
+  u8 *map = (u8 *)t->buf;
+
+  seq = kunit_kcalloc(test, GALEOS_SIM_LOG_LEN, sizeof(*seq), GFP_KERNEL);
+  KUNIT_ASSERT_NOT_ERR_OR_NULL(test, seq);
+
+  /* fill the register cache first */
+  KUNIT_ASSERT_EQ(test, read_regmap(NULL, kobj, &bin_attr_regmap, t->buf, 0, GALEOS_REGMAP_SIZE),
+                  (ssize_t)GALEOS_REGMAP_SIZE);
+  galeos_test_page0(test);
+  galeos_sim_trace(t->trace);
+  KUNIT_EXPECT_EQ(test, read_regmap(NULL, kobj, &bin_attr_regmap, t->buf, 0, GALEOS_REGMAP_SIZE),
+                  (ssize_t)GALEOS_REGMAP_SIZE);
+  galeos_sim_trace(NULL);
+
+  for(page = 0; page < GALEOS_PAGES; page++)
+  {
+    if(page)
+      seq[n++] = (galeos_test_access_t)GALEOS_TEST_W(page - 1, GALEOS_REG_PAGE, page);
+    for(reg = 0; reg < GALEOS_REG_PAGE; reg++)
+    {
+      if(galeos_volatile_reg(NULL, GALEOS_PAGED_REG(page, reg)))
+        seq[n++] = (galeos_test_access_t)GALEOS_TEST_R(page, reg, map[page * GALEOS_PAGE_LEN + reg]);
+    }
+    KUNIT_EXPECT_EQ(test, map[page * GALEOS_PAGE_LEN + GALEOS_REG_PAGE], (u8)page);
+  }
+  galeos_test_expect(test, seq, n);
+}
+
+/*
+ * A modem interrupt is handled in the interrupt thread: 0x62 and the
+ * status of every channel in one request, which deasserts the line and
+ * reports the flagged channel.
+ */
+static void galeos_test_irq( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t seq[] = {
+    GALEOS_TEST_R(0, GALEOS_REG_IRQ, BIT(2)),
+    GALEOS_TEST_R(0, GALEOS_REG_STATUS, GALEOS_STATUS_LINK),
+    GALEOS_TEST_W(0, GALEOS_REG_PAGE, 1),
+    GALEOS_TEST_R(1, GALEOS_REG_STATUS, GALEOS_STATUS_LINK),
+    GALEOS_TEST_W(1, GALEOS_REG_PAGE, 2),
+    GALEOS_TEST_R(2, GALEOS_REG_STATUS, GALEOS_STATUS_LINK),
+    GALEOS_TEST_W(2, GALEOS_REG_PAGE, 3),
+    GALEOS_TEST_R(3, GALEOS_REG_STATUS, GALEOS_STATUS_LINK),
+    GALEOS_TEST_W(3, GALEOS_REG_PAGE, 0),
+  };
+  unsigned long timeout;
+  unsigned int pending;
+  u32 chan_seq;
+
+  KUNIT_ASSERT_NE(test, t->dev->irq, 0);
+  /* channels flagged by earlier mode changes */
+  galeos_lock(t->dev);
+  KUNIT_ASSERT_EQ(test, regmap_read(t->dev->regmap, GALEOS_REG_IRQ, &pending), 0);
+  galeos_unlock(t->dev);
+  galeos_test_page0(test);
+  chan_seq = READ_ONCE(t->dev->chan_seq[2]);
+
+  galeos_sim_trace(t->trace);
+  galeos_sim_raise_irq(0, BIT(2));
+  timeout = jiffies + HZ;
+  while(READ_ONCE(t->dev->chan_seq[2]) == chan_seq && time_before(jiffies, timeout))
+    msleep(1);
+  galeos_sim_trace(NULL);
+
+  KUNIT_EXPECT_NE(test, READ_ONCE(t->dev->chan_seq[2]), chan_seq);
+  KUNIT_EXPECT_EQ(test, READ_ONCE(t->dev->status[2]), (u8)GALEOS_STATUS_LINK);
+  KUNIT_EXPECT_EQ(test, gpio_get_value(t->dev->gpio_irq), 1);
+  galeos_test_expect(test, seq, ARRAY_SIZE(seq));
+}
+
+typedef struct {
+  struct work_struct work;
+  galeosdev_data_t *dev;
+  char *buf;
+  ssize_t ret;
+  struct completion done;
+} galeos_test_async_t;
+
+static void galeos_test_async_work( struct work_struct *work )
+{
+  galeos_test_async_t *a = container_of(work, galeos_test_async_t, work);
+
+  a->ret = show_device_version(a->dev->device, &dev_attr_device_version, a->buf);
+  complete(&a->done);
+}
+
+/* A request for a busy modem waits off the bus and goes out on the rising edge of rdy */
+static void galeos_test_rdy_park( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t seq[] = {
+    GALEOS_TEST_R(0, GALEOS_REG_VERSION, t->dev->modem_version),
+  };
+  galeos_test_async_t a = { .dev = t->dev, .buf = t->buf };
+  u64 waits = t->dev->stats.rdy_waits;
+
+  KUNIT_ASSERT_NE(test, t->dev->rdy_irq, 0);
+  galeos_test_page0(test);
+  init_completion(&a.done);
+  INIT_WORK_ONSTACK(&a.work, galeos_test_async_work);
+
+  galeos_sim_drop_rdy(0, 0);
+  galeos_sim_trace(t->trace);
+  queue_work(system_unbound_wq, &a.work);
+  KUNIT_EXPECT_EQ(test, wait_for_completion_timeout(&a.done, msecs_to_jiffies(20)), 0UL);
+  KUNIT_EXPECT_EQ(test, t->trace->accesses, 0U);
+  KUNIT_EXPECT_EQ(test, t->dev->stats.rdy_waits, waits + 1);
+  galeos_sim_raise_rdy(0);
+  KUNIT_EXPECT_NE(test, wait_for_completion_timeout(&a.done, HZ), 0UL);
+  flush_work(&a.work);
+  destroy_work_on_stack(&a.work);
+  galeos_sim_trace(NULL);
+
+  KUNIT_EXPECT_EQ(test, a.ret, (ssize_t)5);
+  galeos_test_expect(test, seq, ARRAY_SIZE(seq));
+}
+
+/* A modem that stays busy fails the request after GALEOS_RDY_TIMEOUT_MS, without bus traffic */
+static void galeos_test_rdy_timeout( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  u64 timeouts = t->dev->stats.rdy_timeouts;
+  ktime_t start;
+  ssize_t ret;
+
+  KUNIT_ASSERT_NE(test, t->dev->rdy_irq, 0);
+  galeos_test_page0(test);
+  galeos_sim_drop_rdy(0, 0);
+  galeos_sim_trace(t->trace);
+  start = ktime_get();
+  ret = show_device_version(t->dev->device, &dev_attr_device_version, t->buf);
+  galeos_sim_trace(NULL);
+  galeos_sim_raise_rdy(0);
+
+  KUNIT_EXPECT_EQ(test, ret, (ssize_t)-ETIMEDOUT);
+  KUNIT_EXPECT_GE(test, ktime_ms_delta(ktime_get(), start), (s64)GALEOS_RDY_TIMEOUT_MS);
+  KUNIT_EXPECT_EQ(test, t->dev->stats.rdy_timeouts, timeouts + 1);
+  galeos_test_expect(test, NULL, 0);
+}
+
+/*
+ * A paged request that times out after switching pages leaves the modem
+ * on another page; the next request puts the page regmap has cached back
+ * before anything else.
+ */
+static void galeos_test_rdy_page( struct kunit *test )
+{
+  galeos_test_t *t = test->priv;
+  const galeos_test_access_t seq[] = {
+    GALEOS_TEST_W(1, GALEOS_REG_PAGE, 0),
+    GALEOS_TEST_R(0, GALEOS_REG_VERSION, t->dev->modem_version),
+  };
+
+  KUNIT_ASSERT_NE(test, t->dev->rdy_irq, 0);
+  galeos_test_page0(test);
+  /* busy after 0x62, the status of channel 0 and the switch to page 1 */
+  galeos_sim_drop_rdy(0, 3);
+  KUNIT_EXPECT_EQ(test, galeos_status_refresh(t->dev), -ETIMEDOUT);
+  galeos_sim_raise_rdy(0);
+
+  galeos_sim_trace(t->trace);
+  KUNIT_EXPECT_EQ(test, show_device_version(t->dev->device, &dev_attr_device_version, t->buf),
+                  (ssize_t)5);
+  galeos_sim_trace(NULL);
+  galeos_test_expect(test, seq, ARRAY_SIZE(seq));
+}
+
+static struct kunit_case galeos_test_cases[] = {
+  KUNIT_CASE(galeos_test_device_info),
+  KUNIT_CASE(galeos_test_speed),
+  KUNIT_CASE(galeos_test_mode),
+  KUNIT_CASE(galeos_test_pam),
+  KUNIT_CASE(galeos_test_regmap_dump),
+  KUNIT_CASE(galeos_test_irq),
+  KUNIT_CASE(galeos_test_rdy_park),
+  KUNIT_CASE(galeos_test_rdy_timeout),
+  KUNIT_CASE(galeos_test_rdy_page),
+  {}
+};
+
+static struct kunit_suite galeos_test_suite = {
+  .name = "galeos",
+  .init = galeos_test_init,
+  .test_cases = galeos_test_cases,
+};
+
+kunit_test_suite(galeos_test_suite);
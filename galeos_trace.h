@@ -0,0 +1,124 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM galeos
+
+#if !defined(__GALEOS_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __GALEOS_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+/*
+ * Driver tracepoints, /sys/kernel/debug/tracing/events/galeos/. Times
+ * are in ns; page is the channel page selected in the modem at the time
+ * of the access, 0xFF when not known yet.
+ */
+TRACE_EVENT(galeos_reg_access,
+  TP_PROTO(struct device *dev, u8 page, u8 reg, u8 value, bool read, s64 ns),
+  TP_ARGS(dev, page, reg, value, read, ns),
+  TP_STRUCT__entry(
+    __string(dev, dev_name(dev))
+    __field(u8, page)
+    __field(u8, reg)
+    __field(u8, value)
+    __field(bool, read)
+    __field(s64, ns)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev_name(dev));
+    __entry->page = page;
+    __entry->reg = reg;
+    __entry->value = value;
+    __entry->read = read;
+    __entry->ns = ns;
+  ),
+  TP_printk("%s %s page=0x%02x reg=0x%02x value=0x%02x ns=%lld",
+            __get_str(dev), __entry->read ? "read" : "write",
+            __entry->page, __entry->reg, __entry->value, __entry->ns)
+);
+
+TRACE_EVENT(galeos_page_switch,
+  TP_PROTO(struct device *dev, u8 from, u8 to),
+  TP_ARGS(dev, from, to),
+  TP_STRUCT__entry(
+    __string(dev, dev_name(dev))
+    __field(u8, from)
+    __field(u8, to)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev_name(dev));
+    __entry->from = from;
+    __entry->to = to;
+  ),
+  TP_printk("%s page 0x%02x -> 0x%02x", __get_str(dev), __entry->from, __entry->to)
+);
+
+/* One engine request: register accesses of a batch, poll, regmap chunk */
+TRACE_EVENT(galeos_request,
+  TP_PROTO(struct device *dev, unsigned count, int status, s64 ns),
+  TP_ARGS(dev, count, status, ns),
+  TP_STRUCT__entry(
+    __string(dev, dev_name(dev))
+    __field(unsigned, count)
+    __field(int, status)
+    __field(s64, ns)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev_name(dev));
+    __entry->count = count;
+    __entry->status = status;
+    __entry->ns = ns;
+  ),
+  TP_printk("%s ops=%u status=%d ns=%lld", __get_str(dev),
+            __entry->count, __entry->status, __entry->ns)
+);
+
+TRACE_EVENT(galeos_lock,
+  TP_PROTO(struct device *dev, s64 wait_ns),
+  TP_ARGS(dev, wait_ns),
+  TP_STRUCT__entry(
+    __string(dev, dev_name(dev))
+    __field(s64, wait_ns)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev_name(dev));
+    __entry->wait_ns = wait_ns;
+  ),
+  TP_printk("%s wait_ns=%lld", __get_str(dev), __entry->wait_ns)
+);
+
+DECLARE_EVENT_CLASS(galeos_attr,
+  TP_PROTO(struct device *dev, const char *attr, bool store, ssize_t ret),
+  TP_ARGS(dev, attr, store, ret),
+  TP_STRUCT__entry(
+    __string(dev, dev_name(dev))
+    __string(attr, attr)
+    __field(bool, store)
+    __field(ssize_t, ret)
+  ),
+  TP_fast_assign(
+    __assign_str(dev, dev_name(dev));
+    __assign_str(attr, attr);
+    __entry->store = store;
+    __entry->ret = ret;
+  ),
+  TP_printk("%s %s %s ret=%zd", __get_str(dev), __get_str(attr),
+            __entry->store ? "store" : "show", __entry->ret)
+);
+
+/* Entry and exit of the DSL attribute handlers */
+DEFINE_EVENT(galeos_attr, galeos_attr_enter,
+  TP_PROTO(struct device *dev, const char *attr, bool store, ssize_t ret),
+  TP_ARGS(dev, attr, store, ret)
+);
+
+DEFINE_EVENT(galeos_attr, galeos_attr_exit,
+  TP_PROTO(struct device *dev, const char *attr, bool store, ssize_t ret),
+  TP_ARGS(dev, attr, store, ret)
+);
+
+#endif//__GALEOS_TRACE_H__
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE galeos_trace
+#include <trace/define_trace.h>